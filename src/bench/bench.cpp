@@ -0,0 +1,409 @@
+#include "bytecode.hpp"
+#include "machines.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <numeric>
+#include <optional>
+#include <ranges>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <unistd.h>
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+struct settings_t {
+  std::vector<std::string> machines{};
+  std::vector<std::filesystem::path> programs{};
+  std::size_t iterations = 5;
+  std::size_t warmups = 1;
+  std::size_t input_size = 1 << 20;
+  std::size_t generated_size = 0;
+  bool profile = false;
+  std::string format = "json";
+};
+
+struct program_t {
+  std::string name;
+  std::string source;
+  std::optional<std::string> expected;
+};
+
+struct result_t {
+  std::string program;
+  std::string machine;
+  std::string phase;
+  std::vector<std::int64_t> samples; // nanoseconds, sorted
+  std::size_t bytes = 0;             // of source compiled, for throughput
+};
+
+void usage(FILE *f) {
+  std::fputs("usage: ccbf-bench [-m machine]... [-n iterations] [-w warmups]\n"
+             "                  [-i input-bytes] [-g program-bytes] [-p]\n"
+             "                  [-f json|csv] [program.bf]...\n",
+             f);
+}
+
+settings_t parse_cmdline(int argc, char *argv[]) {
+  settings_t result;
+
+  int c;
+  while ((c = getopt(argc, argv, ":m:n:w:i:g:pf:h")) != -1) {
+    switch (c) {
+    case 'm':
+      result.machines.emplace_back(optarg);
+      break;
+    case 'n':
+      result.iterations = std::max(1ul, std::stoul(optarg));
+      break;
+    case 'w':
+      result.warmups = std::stoul(optarg);
+      break;
+    case 'i':
+      result.input_size = std::stoul(optarg);
+      break;
+    case 'g':
+      result.generated_size = std::stoul(optarg);
+      break;
+    case 'p':
+      result.profile = true;
+      break;
+    case 'f':
+      result.format = optarg;
+      if (result.format != "json" && result.format != "csv")
+        throw std::runtime_error(std::format("bad format: {}", optarg));
+      break;
+    case 'h':
+      usage(stdout);
+      std::exit(EXIT_SUCCESS);
+    case ':':
+      throw std::runtime_error(
+          std::format("-{} without argument", char(optopt)));
+    default:
+      usage(stderr);
+      throw std::runtime_error(std::format("unknown arg -{}", char(optopt)));
+    }
+  }
+
+  if (result.machines.empty()) {
+    for (auto name : brainfk::machine_names())
+      result.machines.emplace_back(name);
+  }
+
+  for (int i = optind; i < argc; ++i)
+    result.programs.emplace_back(argv[i]);
+
+  if (result.programs.empty()) {
+    // BRAINFK_BENCH_CORPUS is a ':' separated list of paths set by cmake
+    std::string_view corpus = BRAINFK_BENCH_CORPUS;
+    for (auto path : corpus | std::views::split(':'))
+      result.programs.emplace_back(std::string_view(path));
+  }
+
+  return result;
+}
+
+std::string slurp(const std::filesystem::path &path) {
+  std::ifstream f{path, std::ios_base::binary};
+  if (!f)
+    throw std::runtime_error(std::format("can't open {}", path.string()));
+  std::ostringstream ss;
+  ss << f.rdbuf();
+  return std::move(ss).str();
+}
+
+program_t load_program(const std::filesystem::path &path) {
+  program_t result{path.stem().string(), slurp(path), std::nullopt};
+  // an optional sibling .txt holds the expected output
+  if (auto expected = std::filesystem::path(path).replace_extension(".txt");
+      std::filesystem::exists(expected))
+    result.expected = slurp(expected);
+  return result;
+}
+
+/**
+ * Deterministic, zero-free input so that echo style programs consume it all.
+ */
+std::string make_input(std::size_t size) {
+  static constexpr std::string_view text =
+      "the quick brown fox jumps over the lazy dog\n";
+  std::string result;
+  result.reserve(size);
+  while (result.size() < size)
+    result += text.substr(0, std::min(text.size(), size - result.size()));
+  return result;
+}
+
+/**
+ * A program of about size bytes that looks machine generated: a short top
+ * level loop per character of the text it prints, between comments.
+ */
+program_t make_program(std::size_t size) {
+  static constexpr std::string_view text =
+      "the quick brown fox jumps over the lazy dog\n";
+  program_t result{"generated", "", ""};
+  for (std::size_t i = 0; result.source.size() < size; ++i) {
+    const auto c = text[i % text.size()];
+    result.source += std::format("# {}\n>++++++++[<{}>-]<{}.[-]\n", i,
+                                 std::string(std::size_t(c / 8), '+'),
+                                 std::string(std::size_t(c % 8), '+'));
+    *result.expected += c;
+  }
+  return result;
+}
+
+/**
+ * Collects output in a string, a buffer at a time.
+ */
+class string_output_t : public brainfk::output_t {
+public:
+  explicit string_output_t(std::string &s) : s_(s) { storage(storage_); }
+
+private:
+  void write(std::span<const std::byte> bytes) override {
+    s_.append(reinterpret_cast<const char *>(bytes.data()), bytes.size());
+  }
+
+  std::string &s_;
+  std::array<std::byte, 1 << 16> storage_;
+};
+
+std::int64_t elapsed_ns(clock_type::time_point since) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             clock_type::now() - since)
+      .count();
+}
+
+std::vector<result_t> run(const settings_t &settings,
+                          const program_t &program, const std::string &input) {
+  std::vector<result_t> results;
+
+  for (const auto &name : settings.machines) {
+    auto machine = brainfk::make_machine(name);
+    result_t compile{program.name, name, "compile", {}, program.source.size()};
+    result_t execute{program.name, name, "execute", {}};
+
+    brainfk::machine_t::executable_ptr_t executable;
+    for (std::size_t i = 0; i < settings.warmups + settings.iterations; ++i) {
+      // drop the last compilation first, machines may share code between
+      // live executables of the same program
+      executable.reset();
+      const auto start = clock_type::now();
+      executable = machine->compile(program.source);
+      const auto ns = elapsed_ns(start);
+      if (i >= settings.warmups)
+        compile.samples.push_back(ns);
+    }
+
+    auto memory = std::make_unique<std::byte[]>(30'000);
+    std::string output;
+    output.reserve(1 << 20);
+    string_output_t sink{output};
+
+    for (std::size_t i = 0; i < settings.warmups + settings.iterations; ++i) {
+      std::fill_n(memory.get(), 30'000, std::byte(0));
+      output.clear();
+      brainfk::memory_input_t source{std::as_bytes(std::span(input)),
+                                     brainfk::input_t::eof_t::zero};
+
+      const auto start = clock_type::now();
+      machine->execute(executable, memory.get(), sink, source);
+      const auto ns = elapsed_ns(start);
+      if (i >= settings.warmups)
+        execute.samples.push_back(ns);
+
+      if (i == 0 && program.expected && output != *program.expected)
+        throw std::runtime_error(std::format(
+            "{} produced unexpected output on {}", program.name, name));
+    }
+
+    std::ranges::sort(compile.samples);
+    std::ranges::sort(execute.samples);
+    results.push_back(std::move(compile));
+    results.push_back(std::move(execute));
+  }
+
+  return results;
+}
+
+/**
+ * Add the runs of ops the bytecode of program falls through on to counts.
+ */
+void profile(const program_t &program, const std::string &input,
+             brainfk::bytecode::sequence_counts_t &counts) {
+  const auto instructions =
+      brainfk::bytecode::lower(brainfk::ir::compile(program.source));
+  auto memory = std::make_unique<std::byte[]>(30'000);
+  std::string output;
+  string_output_t sink{output};
+  brainfk::memory_input_t source{std::as_bytes(std::span(input)),
+                                 brainfk::input_t::eof_t::zero};
+  std::vector<std::uint64_t> hits(instructions.size());
+  brainfk::bytecode::profile(instructions, memory.get(), sink, source, hits,
+                             counts);
+}
+
+/**
+ * Runs of ops by descending count with their share of all runs as long,
+ * leaving out those that never ran; a pair's third is empty.
+ */
+void write_profile(FILE *f, const settings_t &settings,
+                   const brainfk::bytecode::sequence_counts_t &counts) {
+  using brainfk::bytecode::op_code_t;
+
+  std::vector<std::tuple<std::uint64_t, op_code_t, op_code_t, op_code_t>>
+      runs;
+  std::uint64_t pairs = 0, triples = 0;
+  for (std::size_t first = 0; first < counts.size(); ++first) {
+    for (std::size_t second = 0; second < counts[first].size(); ++second) {
+      for (std::size_t third = 0; third < counts[first][second].size();
+           ++third) {
+        if (const auto count = counts[first][second][third]) {
+          runs.emplace_back(count, op_code_t(first), op_code_t(second),
+                            op_code_t(third));
+          (op_code_t(third) == op_code_t::halt ? pairs : triples) += count;
+        }
+      }
+    }
+  }
+  std::ranges::sort(runs, std::greater{});
+
+  const auto csv = settings.format == "csv";
+  std::fputs(csv ? "first,second,third,count,share\n" : "[\n", f);
+  for (auto i = runs.begin(); i != runs.end(); ++i) {
+    const auto [count, first, second, third] = *i;
+    const auto pair = third == op_code_t::halt;
+    const auto share = double(count) / double(pair ? pairs : triples);
+    const auto name = [](op_code_t op) {
+      return op == op_code_t::halt ? std::string_view{}
+                                   : brainfk::bytecode::name(op);
+    };
+    std::fputs(
+        (csv ? std::format("{},{},{},{},{:.4f}\n", name(first), name(second),
+                           name(third), count, share)
+             : std::format("  {{\"first\": \"{}\", \"second\": \"{}\", "
+                           "\"third\": \"{}\", \"count\": {}, "
+                           "\"share\": {:.4f}}}{}\n",
+                           name(first), name(second), name(third), count,
+                           share, std::next(i) == runs.end() ? "" : ","))
+            .c_str(),
+        f);
+  }
+  if (!csv)
+    std::fputs("]\n", f);
+}
+
+/**
+ * Nearest-rank percentile of sorted samples.
+ */
+std::int64_t percentile(const std::vector<std::int64_t> &samples, int p) {
+  const auto rank = (p * samples.size() + 99) / 100;
+  return samples[std::clamp<std::size_t>(rank, 1, samples.size()) - 1];
+}
+
+std::int64_t mean(const std::vector<std::int64_t> &samples) {
+  return std::accumulate(samples.begin(), samples.end(), std::int64_t(0)) /
+         std::int64_t(samples.size());
+}
+
+/**
+ * Source megabytes compiled per second at the median, or empty for
+ * execution.
+ */
+std::string throughput(const result_t &r, std::string_view none) {
+  if (!r.bytes)
+    return std::string(none);
+  return std::format("{:.1f}", double(r.bytes) * 1e3 /
+                                   double(std::max<std::int64_t>(
+                                       percentile(r.samples, 50), 1)));
+}
+
+void write_csv(FILE *f, const std::vector<result_t> &results) {
+  std::fputs("program,machine,phase,iterations,min_ns,mean_ns,p50_ns,p90_ns,"
+             "p99_ns,max_ns,mb_per_s\n",
+             f);
+  for (const auto &r : results) {
+    std::fputs(std::format("{},{},{},{},{},{},{},{},{},{},{}\n", r.program,
+                           r.machine, r.phase, r.samples.size(),
+                           r.samples.front(), mean(r.samples),
+                           percentile(r.samples, 50), percentile(r.samples, 90),
+                           percentile(r.samples, 99), r.samples.back(),
+                           throughput(r, ""))
+                   .c_str(),
+               f);
+  }
+}
+
+void write_json(FILE *f, const std::vector<result_t> &results) {
+  std::fputs("[\n", f);
+  for (auto i = results.begin(); i != results.end(); ++i) {
+    const auto &r = *i;
+    std::fputs(
+        std::format("  {{\"program\": \"{}\", \"machine\": \"{}\", "
+                    "\"phase\": \"{}\", \"iterations\": {}, \"min_ns\": {}, "
+                    "\"mean_ns\": {}, \"p50_ns\": {}, \"p90_ns\": {}, "
+                    "\"p99_ns\": {}, \"max_ns\": {}, \"mb_per_s\": {}}}{}\n",
+                    r.program, r.machine, r.phase, r.samples.size(),
+                    r.samples.front(), mean(r.samples),
+                    percentile(r.samples, 50), percentile(r.samples, 90),
+                    percentile(r.samples, 99), r.samples.back(),
+                    throughput(r, "null"),
+                    std::next(i) == results.end() ? "" : ",")
+            .c_str(),
+        f);
+  }
+  std::fputs("]\n", f);
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  try {
+    const auto settings = parse_cmdline(argc, argv);
+    const auto input = make_input(settings.input_size);
+
+    if (settings.profile) {
+      brainfk::bytecode::sequence_counts_t counts{};
+      for (const auto &path : settings.programs)
+        profile(load_program(path), input, counts);
+      if (settings.generated_size)
+        profile(make_program(settings.generated_size), input, counts);
+      write_profile(stdout, settings, counts);
+      return EXIT_SUCCESS;
+    }
+
+    std::vector<result_t> results;
+    for (const auto &path : settings.programs) {
+      const auto program = load_program(path);
+      std::ranges::move(run(settings, program, input),
+                        std::back_inserter(results));
+    }
+    if (settings.generated_size)
+      std::ranges::move(
+          run(settings, make_program(settings.generated_size), input),
+          std::back_inserter(results));
+
+    if (settings.format == "csv")
+      write_csv(stdout, results);
+    else
+      write_json(stdout, results);
+
+    return EXIT_SUCCESS;
+  } catch (const std::exception &e) {
+    std::fprintf(stderr, "ccbf-bench: %s\n", e.what());
+    return EXIT_FAILURE;
+  }
+}
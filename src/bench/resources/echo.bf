@@ -0,0 +1,3 @@
+Input and output bound: copy input to output until a zero byte
+
+,[.,]
@@ -0,0 +1,15 @@
+Nested counting loops with a little arithmetic in the innermost body
+Dispatch bound: almost every instruction executed is a jump or an add
+
+++++++++++[>+++++++++++++++++++++++++<-]>     c1 = 250
+[
+  >++++++++++[>+++++++++++++++++++++++++<-]>  c3 = 250
+  [
+    >++++++++++[>+++++++++++++++++++++++++<-]>  c5 = 250
+    [>+>++<<-]>[-]>[-]<<                        churn c6 and c7 then clear
+    <<-
+  ]
+  <<-
+]
+++++++++[>++++++++<-]>+.                      print A
+[-]++++++++++.                                print newline
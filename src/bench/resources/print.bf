@@ -0,0 +1,14 @@
+Output bound: print 64 lines of 80 letters each 64 times
+
+++++++++[>++++++++<-]>                        c1 = 64 (outer count)
+[
+  >++++++++[>++++++++<-]>                     c3 = 64 (line count)
+  [
+    >++++++++[>++++++++<-]>+                  c5 = 65 ('A')
+    >++++++++++[>++++++++<-]>                 c7 = 80 (column count)
+    [<<.>>-]                                  print c5 c7 times
+    ++++++++++.[-]                            print newline
+    <<[-]<<-                                  clear c5; decrement c3
+  ]
+  <<-
+]
@@ -0,0 +1,14 @@
+Scan bound: lay down a run of 250 marked cells then repeatedly walk the run
+in both directions looking for the zero cells at each end
+
+Layout: c0 scratch; c1 outer count; c2 inner count; c3 zero; c4 on is the run
+
+++++++++++[>+++++++++++++++++++++++++<-]>     c1 = 250
+[>>>[>]+[<]<<-]                               extend the run by one cell c1 times
+<++++++++++[>+++++++++++++++++++++++++<-]>    c1 = 250
+[
+  <++++++++++[>>+++++++++++++++++++++++++<<-]>>  c2 = 250
+  [>>[>]<[<]<-]                                  walk right then left c2 times
+  <-
+]
+++++++++++.                                   print newline
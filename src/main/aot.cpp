@@ -0,0 +1,116 @@
+#include "aot.hpp"
+#include "llvm_machine.hpp"
+#include "util.hpp"
+
+#include <cstdlib>
+#include <format>
+#include <fstream>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+
+namespace {
+
+void write(const std::filesystem::path &path,
+           std::span<const std::byte> bytes) {
+  std::ofstream out{path, std::ios::binary | std::ios::trunc};
+  out.write(reinterpret_cast<const char *>(bytes.data()),
+            std::streamsize(bytes.size()));
+  if (!out.flush())
+    throw std::runtime_error{std::format("can't write {}", path.string())};
+}
+
+/**
+ * The brainfk-runtime library: $CCBF_RUNTIME, else the one beside the
+ * running ccbf in its build tree, else the one installed with it.
+ */
+std::string runtime_library() {
+  if (const auto path = std::getenv("CCBF_RUNTIME"); path && *path)
+    return path;
+  const auto bin =
+      std::filesystem::read_symlink("/proc/self/exe").parent_path();
+  for (const auto &path :
+       {bin / BRAINFK_RUNTIME_NAME,
+        bin / BRAINFK_RUNTIME_LIBDIR / BRAINFK_RUNTIME_NAME}) {
+    if (std::filesystem::exists(path))
+      return path.lexically_normal().string();
+  }
+  throw std::runtime_error{
+      std::format("can't find {} for {}; set CCBF_RUNTIME to it",
+                  BRAINFK_RUNTIME_NAME, bin.string())};
+}
+
+/**
+ * Link object with the runtime into an executable at output.
+ */
+void link(std::span<const std::byte> object,
+          const std::filesystem::path &output) {
+  auto object_path =
+      (std::filesystem::temp_directory_path() / "ccbf-XXXXXX.o").string();
+  brainfk::posix(::close, brainfk::posix(::mkstemps, object_path.data(), 2));
+  brainfk::guard object_guard{[&]() { ::unlink(object_path.c_str()); }};
+  write(object_path, object);
+
+  const char *cxx = std::getenv("CXX");
+  if (!cxx || !*cxx)
+    cxx = "c++";
+  const auto output_path = output.string();
+  const auto runtime = runtime_library();
+  std::vector<const char *> argv{cxx,  object_path.c_str(), runtime.c_str(),
+                                 "-o", output_path.c_str(), nullptr};
+
+  pid_t pid;
+  if (const auto err =
+          ::posix_spawnp(&pid, cxx, nullptr, nullptr,
+                         const_cast<char *const *>(argv.data()), environ))
+    throw std::system_error(err, std::system_category());
+
+  int status;
+  brainfk::posix(::waitpid, pid, &status, 0);
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    throw std::runtime_error{
+        std::format("linking {} with {} failed", output_path, cxx)};
+}
+
+} // namespace
+
+brainfk::emit_t brainfk::parse_emit(std::string_view name) {
+  if (name == "obj")
+    return emit_t::obj;
+  if (name == "exe")
+    return emit_t::exe;
+  if (name == "asm")
+    return emit_t::asm_;
+  if (name == "llvm-ir")
+    return emit_t::llvm_ir;
+  throw std::runtime_error{std::format("bad emit: {}", name)};
+}
+
+void brainfk::emit(std::string_view program, emit_t kind,
+                   const std::filesystem::path &output,
+                   const llvm_options_t &options, unsigned cell_bits) {
+  using artifact_t = llvm_machine_t::artifact_t;
+
+  llvm_machine_t machine{options, cell_bits};
+  switch (kind) {
+  case emit_t::obj:
+    write(output, machine.emit(program, artifact_t::object));
+    break;
+  case emit_t::exe:
+    link(machine.emit(program, artifact_t::object), output);
+    break;
+  case emit_t::asm_:
+    write(output, machine.emit(program, artifact_t::assembly));
+    break;
+  case emit_t::llvm_ir:
+    write(output, machine.emit(program, artifact_t::llvm_ir));
+    break;
+  }
+}
@@ -0,0 +1,35 @@
+#ifndef BRAINFK_AOT_HPP
+#define BRAINFK_AOT_HPP
+
+#include "llvm_machine.hpp"
+
+#include <filesystem>
+#include <string_view>
+
+namespace brainfk {
+
+/**
+ * What --emit writes: an object file, a linked executable, assembly or
+ * llvm ir.
+ */
+enum class emit_t { obj, exe, asm_, llvm_ir };
+
+/**
+ * Parse an --emit argument; throws on an unknown name.
+ */
+emit_t parse_emit(std::string_view name);
+
+/**
+ * Compile program ahead of time, for cells of cell_bits, with an llvm
+ * machine constructed with options and write it to output. Executables are
+ * linked by $CXX (c++ by default) against the brainfk-runtime library,
+ * $CCBF_RUNTIME or else the one built or installed with ccbf, so they need
+ * neither ccbf nor llvm to run.
+ */
+void emit(std::string_view program, emit_t kind,
+          const std::filesystem::path &output,
+          const llvm_options_t &options = {}, unsigned cell_bits = 8);
+
+} // namespace brainfk
+
+#endif // BRAINFK_AOT_HPP
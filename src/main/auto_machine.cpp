@@ -0,0 +1,103 @@
+#include "auto_machine.hpp"
+
+#include <algorithm>
+#include <cstdint>
+
+namespace {
+
+struct executable_t : brainfk::executable_t {
+  executable_t(brainfk::machine_t &machine,
+               brainfk::machine_t::executable_ptr_t executable)
+      : machine_(machine), executable_(std::move(executable)) {}
+
+  brainfk::machine_t &machine_;
+  brainfk::machine_t::executable_ptr_t executable_;
+};
+
+} // namespace
+
+std::string_view
+brainfk::auto_machine_t::choose(const ir::program_t &program) {
+  using ir::op_t;
+
+  // 16 to the power of the loop depth, capped so the sum can't overflow
+  std::uint64_t work = 0;
+  unsigned depth = 0;
+  for (const auto &node : program) {
+    switch (node.op) {
+    case op_t::open:
+      ++depth;
+      break;
+    case op_t::close:
+      --depth;
+      break;
+    case op_t::put:
+    case op_t::get:
+    case op_t::write:
+      continue;
+    default:
+      break;
+    }
+    work += std::uint64_t(1) << (4 * std::min(depth, 8u));
+  }
+
+  // JIT compiling takes a few milliseconds to start then around a hundred
+  // microseconds per node, while native code saves about a nanosecond per
+  // node run
+  const auto cost = (std::uint64_t(program.size()) + 32) << 17;
+  return work > cost ? "llvm" : "threaded";
+}
+
+void brainfk::auto_machine_t::cache(std::shared_ptr<const code_cache_t> cache) {
+  threaded_.cache(cache);
+  if (llvm_)
+    llvm_->cache(cache);
+  cache_ = std::move(cache);
+}
+
+brainfk::llvm_machine_t &brainfk::auto_machine_t::llvm() {
+  if (!llvm_) {
+    llvm_ = std::make_unique<llvm_machine_t>(llvm_options_, cell_bits());
+    llvm_->cache(cache_);
+  }
+  return *llvm_;
+}
+
+brainfk::machine_t::executable_ptr_t
+brainfk::auto_machine_t::compile_impl(std::string_view program) {
+  if (choose(ir::evaluate(ir::compile(program))) == "threaded")
+    return std::make_unique<::executable_t>(threaded_,
+                                            threaded_.compile(program));
+  return std::make_unique<::executable_t>(llvm(), llvm().compile(program));
+}
+
+void brainfk::auto_machine_t::execute_impl(const executable_ptr_t &exe_,
+                                           std::byte *mem, output_t &output,
+                                           input_t &input) {
+  auto &exe = *dynamic_cast<::executable_t *>(exe_.get());
+  exe.machine_.execute(exe.executable_, mem, output, input);
+}
+
+std::optional<brainfk::position_t> brainfk::auto_machine_t::suspendable_impl(
+    const executable_ptr_t &exe_, std::byte *mem, output_t &output,
+    input_t &input, suspend_t &suspend, position_t from) {
+  auto &exe = *dynamic_cast<::executable_t *>(exe_.get());
+  return exe.machine_.execute(exe.executable_, mem, output, input, suspend,
+                              from);
+}
+
+bool brainfk::auto_machine_t::can_suspend_impl(
+    const executable_ptr_t &exe_) const {
+  const auto &exe = *dynamic_cast<const ::executable_t *>(exe_.get());
+  return exe.machine_.can_suspend(exe.executable_);
+}
+
+std::vector<std::uint64_t>
+brainfk::auto_machine_t::profile_impl(std::string_view program,
+                                      const tape_t &tape, output_t &output,
+                                      input_t &input) {
+  auto &machine = choose(ir::compile(program)) == "threaded"
+                      ? static_cast<machine_t &>(threaded_)
+                      : llvm();
+  return machine.profile(program, tape, output, input);
+}
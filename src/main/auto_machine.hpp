@@ -0,0 +1,60 @@
+#ifndef BRAINFK_AUTO_MACHINE_HPP
+#define BRAINFK_AUTO_MACHINE_HPP
+
+#include "handrolled_machine.hpp"
+#include "ir.hpp"
+#include "llvm_machine.hpp"
+#include "machine.hpp"
+
+#include <memory>
+#include <string_view>
+
+namespace brainfk {
+
+/**
+ * Runs each program on the threaded interpreter or the llvm machine, which
+ * ever a static estimate says finishes first: JIT compiling costs about
+ * the same per node whether or not it runs, so it only pays off for
+ * programs that loop a lot. The llvm machine is only constructed once a
+ * program needs it, so snippets never pay for setting up a JIT.
+ */
+class auto_machine_t : public machine_t {
+public:
+  explicit auto_machine_t(llvm_options_t llvm = {}, unsigned cell_bits = 8)
+      : machine_t(cell_bits),
+        threaded_(handrolled_machine_t::dispatch_t::threaded, cell_bits),
+        llvm_options_(llvm) {}
+
+  /**
+   * The machine program would run on, "threaded" or "llvm". The estimate
+   * weighs each node by a guess at how often it runs, 16 times per
+   * enclosing loop, and discounts input and output which cost the same on
+   * either machine.
+   */
+  static std::string_view choose(const ir::program_t &program);
+
+  void cache(std::shared_ptr<const code_cache_t> cache) override;
+
+private:
+  executable_ptr_t compile_impl(std::string_view) override;
+  void execute_impl(const executable_ptr_t &, std::byte *, output_t &,
+                    input_t &) override;
+  std::optional<position_t> suspendable_impl(const executable_ptr_t &,
+                                             std::byte *, output_t &,
+                                             input_t &, suspend_t &,
+                                             position_t) override;
+  bool can_suspend_impl(const executable_ptr_t &) const override;
+  std::vector<std::uint64_t> profile_impl(std::string_view, const tape_t &,
+                                          output_t &, input_t &) override;
+
+  llvm_machine_t &llvm();
+
+  handrolled_machine_t threaded_;
+  llvm_options_t llvm_options_;
+  std::shared_ptr<const code_cache_t> cache_;
+  std::unique_ptr<llvm_machine_t> llvm_;
+};
+
+} // namespace brainfk
+
+#endif // BRAINFK_AUTO_MACHINE_HPP
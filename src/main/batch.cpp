@@ -0,0 +1,127 @@
+#include "batch.hpp"
+
+#include <algorithm>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <thread>
+
+namespace {
+
+/**
+ * Runs task indices on a number of workers, the calling thread among them.
+ * Each worker starts with a contiguous share of the indices, takes from the
+ * front of its own queue and, once that's empty, steals from the back of
+ * another's. Nothing is queued once running, so a worker that finds every
+ * queue empty is done.
+ */
+class pool_t {
+public:
+  pool_t(std::size_t workers, std::size_t tasks) : queues_(workers) {
+    for (std::size_t worker = 0; worker < workers; ++worker) {
+      for (auto task = tasks * worker / workers,
+                end = tasks * (worker + 1) / workers;
+           task != end; ++task)
+        queues_[worker].tasks.push_back(task);
+    }
+  }
+
+  void run(const std::function<void(std::size_t)> &task) {
+    std::vector<std::jthread> threads;
+    for (std::size_t worker = 1; worker < queues_.size(); ++worker)
+      threads.emplace_back([&, worker]() { work(worker, task); });
+    work(0, task);
+  }
+
+private:
+  struct queue_t {
+    std::mutex mutex;
+    std::deque<std::size_t> tasks;
+  };
+
+  void work(std::size_t worker, const std::function<void(std::size_t)> &task) {
+    while (const auto next = take(worker))
+      task(*next);
+  }
+
+  std::optional<std::size_t> take(std::size_t worker) {
+    {
+      auto &own = queues_[worker];
+      std::lock_guard lock{own.mutex};
+      if (!own.tasks.empty()) {
+        const auto result = own.tasks.front();
+        own.tasks.pop_front();
+        return result;
+      }
+    }
+
+    for (std::size_t i = 1; i < queues_.size(); ++i) {
+      auto &victim = queues_[(worker + i) % queues_.size()];
+      std::lock_guard lock{victim.mutex};
+      if (!victim.tasks.empty()) {
+        const auto result = victim.tasks.back();
+        victim.tasks.pop_back();
+        return result;
+      }
+    }
+    return std::nullopt;
+  }
+
+  std::vector<queue_t> queues_;
+};
+
+} // namespace
+
+std::vector<brainfk::batch_result_t>
+brainfk::run_batch(machine_t &machine, std::span<const std::string> programs,
+                   std::span<const batch_task_t> tasks,
+                   const batch_options_t &options) {
+  // compiling stays on this thread; only execute is safe to run concurrently
+  std::vector<machine_t::executable_ptr_t> executables(programs.size());
+  std::vector<std::string> errors(programs.size());
+  std::vector<std::size_t> reaches(programs.size());
+  for (std::size_t i = 0; i < programs.size(); ++i) {
+    reaches[i] = tape_t::reach(programs[i]);
+    try {
+      executables[i] = machine.compile(programs[i]);
+    } catch (const std::exception &e) {
+      errors[i] = e.what();
+    }
+  }
+
+  std::vector<batch_result_t> results(tasks.size());
+  const auto threads =
+      options.threads ? options.threads
+                      : std::max(std::thread::hardware_concurrency(), 1u);
+  pool_t pool{std::clamp<std::size_t>(tasks.size(), 1, threads), tasks.size()};
+
+  pool.run([&](std::size_t i) {
+    const auto &task = tasks[i];
+    auto &result = results[i];
+    if (!errors[task.program].empty()) {
+      result.error = errors[task.program];
+      return;
+    }
+
+    string_output_t output;
+    memory_input_t input{std::as_bytes(std::span(task.input)), options.eof};
+    const auto start = std::chrono::steady_clock::now();
+    try {
+      const tape_t tape{options.tape_size, options.tape_before,
+                        machine.cell_bits() / 8, reaches[task.program]};
+      tape.run([&]() {
+        machine.execute(executables[task.program], tape.data(), output,
+                        input);
+      });
+    } catch (const std::exception &e) {
+      output.flush();
+      result.error = e.what();
+    }
+    result.time = std::chrono::steady_clock::now() - start;
+    result.output = std::move(output.str());
+  });
+
+  return results;
+}
@@ -0,0 +1,58 @@
+#ifndef BRAINFK_BATCH_HPP
+#define BRAINFK_BATCH_HPP
+
+#include "io.hpp"
+#include "machine.hpp"
+#include "tape.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace brainfk {
+
+/**
+ * A run of one of a batch's programs, by index, on the given input.
+ */
+struct batch_task_t {
+  std::size_t program;
+  std::string input;
+};
+
+struct batch_result_t {
+  std::string output;
+  /**
+   * The wall time spent executing, not including compiling the program.
+   */
+  std::chrono::nanoseconds time{};
+  /**
+   * Why the program failed to compile or run, empty if it didn't.
+   */
+  std::string error{};
+};
+
+struct batch_options_t {
+  /**
+   * 0 for one per core.
+   */
+  unsigned threads = 0;
+  std::size_t tape_size = tape_t::default_size;
+  std::size_t tape_before = 0;
+  input_t::eof_t eof = input_t::eof_t::minus_one;
+};
+
+/**
+ * Compile each of programs once on machine, then run tasks on a work
+ * stealing pool of threads, each task on its own tape and output buffer.
+ * Results are in the order of tasks.
+ */
+std::vector<batch_result_t> run_batch(machine_t &machine,
+                                      std::span<const std::string> programs,
+                                      std::span<const batch_task_t> tasks,
+                                      const batch_options_t &options = {});
+
+} // namespace brainfk
+
+#endif // BRAINFK_BATCH_HPP
@@ -0,0 +1,418 @@
+#include "bytecode.hpp"
+#include "scan.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <stack>
+
+std::string_view brainfk::bytecode::name(op_code_t op) {
+  static constexpr std::string_view names[] = {
+      "padd", "dadd", "zjmp", "njmp", "putc", "puts",
+      "getc", "set",  "madd", "scan", "halt",
+  };
+  static_assert(std::size(names) == op_codes);
+  return names[std::size_t(op)];
+}
+
+std::vector<brainfk::bytecode::instruction_t>
+brainfk::bytecode::lower(const ir::program_t &program) {
+  using ir::op_t;
+
+  std::vector<instruction_t> result;
+  std::stack<std::int32_t> opens;
+  for (const auto &node : program) {
+    const auto value = node.value;
+    switch (node.op) {
+    case op_t::add:
+      result.emplace_back(op_code_t::dadd, value, node.offset, 0);
+      break;
+    case op_t::move:
+      result.emplace_back(op_code_t::padd, 0, 0, node.value);
+      break;
+    case op_t::set:
+      result.emplace_back(op_code_t::set, value, node.offset, 0);
+      break;
+    case op_t::mul:
+      result.emplace_back(op_code_t::madd, value, node.offset, node.source);
+      break;
+    case op_t::scan:
+      result.emplace_back(op_code_t::scan, 0, 0, node.value);
+      break;
+    case op_t::put:
+      result.emplace_back(op_code_t::putc, 0, node.offset, 0);
+      break;
+    case op_t::get:
+      result.emplace_back(op_code_t::getc, 0, node.offset, 0);
+      break;
+    case op_t::write:
+      result.emplace_back(op_code_t::puts, value, 0, node.source);
+      break;
+    case op_t::open:
+      opens.push(std::int32_t(result.size()));
+      result.emplace_back(op_code_t::zjmp, 0, 0, 0);
+      break;
+    case op_t::close:
+      result[opens.top()].operand =
+          std::int32_t(result.size()) - opens.top();
+      result.emplace_back(op_code_t::njmp, 0, 0,
+                          opens.top() - std::int32_t(result.size()));
+      opens.pop();
+      break;
+    }
+  }
+
+  return result;
+}
+
+std::vector<std::byte>
+brainfk::bytecode::encode(std::span<const instruction_t> instructions) {
+  std::vector<std::byte> result(instructions.size_bytes());
+  for (std::size_t i = 0; i < instructions.size(); ++i) {
+    const auto &instruction = instructions[i];
+    const auto at = result.data() + i * sizeof(instruction_t);
+    const auto field = [&](std::size_t offset, const auto &value) {
+      std::memcpy(at + offset, &value, sizeof(value));
+    };
+    field(offsetof(instruction_t, op_code), instruction.op_code);
+    field(offsetof(instruction_t, value), instruction.value);
+    field(offsetof(instruction_t, offset), instruction.offset);
+    field(offsetof(instruction_t, operand), instruction.operand);
+  }
+  return result;
+}
+
+std::optional<std::vector<brainfk::bytecode::instruction_t>>
+brainfk::bytecode::decode(std::span<const std::byte> bytes,
+                          std::size_t reach) {
+  if (bytes.size() % sizeof(instruction_t))
+    return std::nullopt;
+
+  std::vector<instruction_t> result(bytes.size() / sizeof(instruction_t));
+  std::memcpy(result.data(), bytes.data(), bytes.size());
+
+  // a program's offsets, and its moves between one access and the next,
+  // each span at most its <s and >s, a third of its reach; then no access
+  // is further than reach from the last
+  const auto steps = std::int64_t(reach / 3);
+  const auto near = [&](std::int32_t distance) {
+    return std::abs(std::int64_t(distance)) <= steps;
+  };
+  // since the last access
+  std::int64_t moved = 0;
+
+  const auto size = std::int64_t(result.size());
+  for (std::int64_t i = 0; i < size; ++i) {
+    const auto &instruction = result[std::size_t(i)];
+    switch (instruction.op_code) {
+    case op_code_t::padd:
+      moved += std::abs(std::int64_t(instruction.operand));
+      if (moved > steps)
+        return std::nullopt;
+      break;
+    case op_code_t::puts:
+      if (std::uint32_t(instruction.operand) > ir::max_written)
+        return std::nullopt;
+      break;
+    case op_code_t::zjmp:
+    case op_code_t::njmp:
+      if (const auto target = i + instruction.operand;
+          target < 0 || target >= size)
+        return std::nullopt;
+      moved = 0;
+      break;
+    case op_code_t::madd:
+      if (!near(instruction.operand))
+        return std::nullopt;
+      [[fallthrough]];
+    case op_code_t::dadd:
+    case op_code_t::putc:
+    case op_code_t::getc:
+    case op_code_t::set:
+      if (!near(instruction.offset))
+        return std::nullopt;
+      moved = 0;
+      break;
+    case op_code_t::scan:
+      if (!near(instruction.operand))
+        return std::nullopt;
+      moved = 0;
+      break;
+    default:
+      return std::nullopt;
+    }
+  }
+  return result;
+}
+
+template <typename Cell>
+void brainfk::bytecode::profile(std::span<const instruction_t> instructions,
+                                std::byte *tape, output_t &output,
+                                input_t &input, std::span<std::uint64_t> hits,
+                                sequence_counts_t &sequences) {
+  auto pointer = reinterpret_cast<Cell *>(tape);
+  const auto size = std::ptrdiff_t(instructions.size());
+  // what fell through to this instruction, halt if it was jumped to
+  auto previous = op_code_t::halt;
+  for (std::ptrdiff_t i = 0, next; i < size; i = next) {
+    const auto &instruction = instructions[std::size_t(i)];
+    ++hits[std::size_t(i)];
+    next = i + 1;
+    switch (instruction.op_code) {
+    case op_code_t::padd:
+      pointer += instruction.operand;
+      break;
+    case op_code_t::dadd:
+      pointer[instruction.offset] =
+          Cell(pointer[instruction.offset] + Cell(instruction.value));
+      break;
+    case op_code_t::zjmp:
+      if (!*pointer)
+        next += instruction.operand;
+      break;
+    case op_code_t::njmp:
+      if (*pointer)
+        next += instruction.operand;
+      break;
+    case op_code_t::putc:
+      output.put(std::byte(pointer[instruction.offset]));
+      break;
+    case op_code_t::puts:
+      for (std::int32_t j = 0; j < instruction.operand; ++j)
+        output.put(ir::written(instruction.value, std::size_t(j)));
+      break;
+    case op_code_t::getc:
+      pointer[instruction.offset] = input.get(pointer[instruction.offset]);
+      break;
+    case op_code_t::set:
+      pointer[instruction.offset] = Cell(instruction.value);
+      break;
+    case op_code_t::madd:
+      if (const auto factor = unsigned(pointer[instruction.operand]))
+        pointer[instruction.offset] =
+            Cell(pointer[instruction.offset] +
+                 factor * unsigned(instruction.value));
+      break;
+    case op_code_t::scan:
+      pointer = scan(pointer, instruction.operand);
+      break;
+    case op_code_t::halt:
+      return;
+    }
+    const auto op = std::size_t(instruction.op_code);
+    if (next == i + 1 && next < size) {
+      const auto following =
+          std::size_t(instructions[std::size_t(next)].op_code);
+      ++sequences[op][following][std::size_t(op_code_t::halt)];
+      if (previous != op_code_t::halt)
+        ++sequences[std::size_t(previous)][op][following];
+      previous = instruction.op_code;
+    } else {
+      previous = op_code_t::halt;
+    }
+  }
+}
+
+template void brainfk::bytecode::profile<std::uint8_t>(
+    std::span<const instruction_t>, std::byte *, output_t &, input_t &,
+    std::span<std::uint64_t>, sequence_counts_t &);
+template void brainfk::bytecode::profile<std::uint16_t>(
+    std::span<const instruction_t>, std::byte *, output_t &, input_t &,
+    std::span<std::uint64_t>, sequence_counts_t &);
+template void brainfk::bytecode::profile<std::uint32_t>(
+    std::span<const instruction_t>, std::byte *, output_t &, input_t &,
+    std::span<std::uint64_t>, sequence_counts_t &);
+
+template <typename Cell>
+std::optional<brainfk::position_t>
+brainfk::bytecode::run(std::span<const instruction_t> instructions,
+                       std::byte *tape, position_t from, output_t &output,
+                       input_t &input, suspend_t &suspend) {
+  const auto origin = reinterpret_cast<Cell *>(tape);
+  auto pointer = origin + from.cell;
+  const auto size = instructions.size();
+  for (auto i = from.pc; i < size; ++i) {
+    const auto &instruction = instructions[i];
+    switch (instruction.op_code) {
+    case op_code_t::padd:
+      pointer += instruction.operand;
+      break;
+    case op_code_t::dadd:
+      pointer[instruction.offset] =
+          Cell(pointer[instruction.offset] + Cell(instruction.value));
+      break;
+    case op_code_t::zjmp:
+      if (!*pointer)
+        i += std::size_t(instruction.operand);
+      break;
+    case op_code_t::njmp:
+      if (*pointer) {
+        i -= std::size_t(-instruction.operand);
+        // stop with the loop's body next
+        if (suspend.due())
+          return position_t{i + 1, pointer - origin};
+      }
+      break;
+    case op_code_t::putc:
+      output.put(std::byte(pointer[instruction.offset]));
+      break;
+    case op_code_t::puts:
+      for (std::int32_t j = 0; j < instruction.operand; ++j)
+        output.put(ir::written(instruction.value, std::size_t(j)));
+      break;
+    case op_code_t::getc:
+      pointer[instruction.offset] = input.get(pointer[instruction.offset]);
+      break;
+    case op_code_t::set:
+      pointer[instruction.offset] = Cell(instruction.value);
+      break;
+    case op_code_t::madd:
+      if (const auto factor = unsigned(pointer[instruction.operand]))
+        pointer[instruction.offset] =
+            Cell(pointer[instruction.offset] +
+                 factor * unsigned(instruction.value));
+      break;
+    case op_code_t::scan:
+      pointer = scan(pointer, instruction.operand);
+      break;
+    case op_code_t::halt:
+      return std::nullopt;
+    }
+  }
+  return std::nullopt;
+}
+
+template std::optional<brainfk::position_t>
+brainfk::bytecode::run<std::uint8_t>(std::span<const instruction_t>,
+                                     std::byte *, position_t, output_t &,
+                                     input_t &, suspend_t &);
+template std::optional<brainfk::position_t>
+brainfk::bytecode::run<std::uint16_t>(std::span<const instruction_t>,
+                                      std::byte *, position_t, output_t &,
+                                      input_t &, suspend_t &);
+template std::optional<brainfk::position_t>
+brainfk::bytecode::run<std::uint32_t>(std::span<const instruction_t>,
+                                      std::byte *, position_t, output_t &,
+                                      input_t &, suspend_t &);
+
+std::vector<std::byte> brainfk::bytecode::compact::encode(
+    std::span<const instruction_t> instructions, std::size_t cell_size) {
+  const auto fits = [](std::int64_t n) {
+    return n >= std::numeric_limits<std::int8_t>::min() &&
+           n <= std::numeric_limits<std::int8_t>::max();
+  };
+  const auto jump = [](const instruction_t &i) {
+    return i.op_code == op_code_t::zjmp || i.op_code == op_code_t::njmp;
+  };
+
+  static_assert(std::ranges::none_of(superinstructions, [](auto ops) {
+    return std::ranges::any_of(ops.begin(), ops.begin() + length(ops) - 1,
+                               [](op_code_t op) {
+                                 return op == op_code_t::zjmp ||
+                                        op == op_code_t::njmp;
+                               });
+  }));
+
+  // fuse into as few op bytes as possible, working back from the end:
+  // fewest[i] is how many the instructions from i on need and fusion[i]
+  // the superinstruction i starts, if any, for that
+  constexpr auto none = std::size(superinstructions);
+  const auto count = instructions.size();
+  std::vector<std::size_t> fusion(count, none);
+  std::vector<std::size_t> fewest(count + 1);
+  for (auto i = count; i-- > 0;) {
+    fewest[i] = fewest[i + 1] + 1;
+    for (std::size_t k = 0; k < none; ++k) {
+      const auto &ops = superinstructions[k];
+      const auto n = length(ops);
+      if (i + n <= count && fewest[i + n] + 1 < fewest[i] &&
+          std::ranges::equal(
+              ops.begin(), ops.begin() + n, instructions.begin() + i,
+              instructions.begin() + i + n, {}, {}, &instruction_t::op_code)) {
+        fewest[i] = fewest[i + n] + 1;
+        fusion[i] = k;
+      }
+    }
+  }
+
+  // head[i] is the instruction starting i's encoding
+  std::vector<std::size_t> head(count);
+  for (std::size_t i = 0; i < count;) {
+    const auto n =
+        fusion[i] == none ? 1 : length(superinstructions[fusion[i]]);
+    std::fill_n(head.begin() + std::ptrdiff_t(i), n, i);
+    i += n;
+  }
+
+  // jumps start narrow and widen until every distance fits; widening only
+  // lengthens distances so this settles
+  std::vector<bool> wide(count);
+  for (std::size_t i = 0; i < count; ++i) {
+    if (!jump(instructions[i]) &&
+        !(fits(instructions[i].offset) && fits(instructions[i].operand)))
+      wide[head[i]] = true;
+  }
+
+  // where each instruction's op byte is or would be, and where its encoding
+  // ends
+  std::vector<std::int64_t> at(count);
+  std::vector<std::int64_t> ends(count);
+  const auto width = [&](std::size_t i) {
+    return wide[head[i]] ? sizeof(std::int32_t) : 1;
+  };
+  const auto distance = [&](std::size_t i) {
+    return ends[std::size_t(std::int64_t(i) + instructions[i].operand)] -
+           at[i];
+  };
+  for (bool changed = true; changed;) {
+    std::int64_t end = 0;
+    for (std::size_t i = 0; i < count; ++i) {
+      at[i] = head[i] == i ? end : end - 1;
+      end += std::int64_t(
+                 size(instructions[i].op_code, width(i), cell_size)) -
+             (head[i] == i ? 0 : 1);
+      ends[i] = end;
+      if (head[i] != i)
+        ends[head[i]] = end;
+    }
+    changed = false;
+    for (std::size_t i = 0; i < count; ++i) {
+      if (jump(instructions[i]) && !wide[head[i]] && !fits(distance(i))) {
+        wide[head[i]] = true;
+        changed = true;
+      }
+    }
+  }
+
+  std::vector<std::byte> result;
+  result.reserve(std::size_t(count ? ends.back() : 0) + 1);
+  const auto put = [&](std::int64_t n, bool wide) {
+    const auto value = std::int32_t(n);
+    const auto bytes = std::as_bytes(std::span(&value, 1));
+    result.insert(result.end(), bytes.begin(),
+                  bytes.begin() + (wide ? sizeof(value) : 1));
+  };
+  for (std::size_t i = 0; i < count; ++i) {
+    const auto &instruction = instructions[i];
+    const auto op = instruction.op_code;
+    if (head[i] == i) {
+      const auto code = fusion[i] == none ? std::uint8_t(op)
+                                          : std::uint8_t(fused + fusion[i]);
+      result.push_back(std::byte(code | (wide[i] ? compact::wide : 0)));
+    }
+    if (has_value(op)) {
+      const auto bytes = std::as_bytes(std::span(&instruction.value, 1));
+      result.insert(result.end(), bytes.begin(),
+                    bytes.begin() + value_size(op, cell_size));
+    }
+    if (has_offset(op))
+      put(instruction.offset, wide[head[i]]);
+    if (has_operand(op))
+      put(jump(instruction) ? distance(i) : instruction.operand,
+          wide[head[i]]);
+  }
+  result.push_back(std::byte(op_code_t::halt));
+  return result;
+}
@@ -0,0 +1,203 @@
+#ifndef BRAINFK_BYTECODE_HPP
+#define BRAINFK_BYTECODE_HPP
+
+#include "checkpoint.hpp"
+#include "io.hpp"
+#include "ir.hpp"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <vector>
+
+namespace brainfk::bytecode {
+
+/**
+ * The version of lower's output, in cache and checkpoint keys; change it
+ * whenever the instructions a program lowers to might.
+ */
+inline constexpr std::string_view version = "bytecode-4";
+
+enum class op_code_t : std::uint8_t {
+  padd, // move pointer by signed operand
+  dadd, // add value to the cell at offset
+  zjmp, // jump to a signed operand if zero
+  njmp, // jump to a signed operand if non-zero
+  putc, // output the cell at offset
+  puts, // output operand bytes packed in value, as by an ir write
+  getc, // input into the cell at offset
+  set,  // set the cell at offset to value
+  madd, // if the cell at operand isn't zero, add it times value to offset's
+  scan, // move pointer by operand until it points at a zero cell
+  halt, // stop executing (terminates threaded code)
+};
+
+inline constexpr std::size_t op_codes = std::size_t(op_code_t::halt) + 1;
+
+std::string_view name(op_code_t op);
+
+/**
+ * value is as in the ir, for cells of any width to truncate.
+ */
+struct instruction_t {
+  op_code_t op_code;
+  std::int32_t value;
+  std::int32_t offset;
+  std::int32_t operand;
+};
+
+/**
+ * Lower optimized ir one node to one instruction, so an instruction's index
+ * is its node's; a loop's zjmp and njmp are its open and close.
+ */
+std::vector<instruction_t> lower(const ir::program_t &program);
+
+/**
+ * The bytes of instructions for decode, e.g. for the code cache, with the
+ * padding between fields zeroed.
+ */
+std::vector<std::byte> encode(std::span<const instruction_t> instructions);
+
+/**
+ * Bytecode from its bytes, e.g. from the code cache, for a program of
+ * tape_t::reach reach; rejected unless every op code and jump is in range,
+ * and every offset and move is as short as the program's can be, so a
+ * corrupt copy can't crash a run or step past a tape's guards.
+ */
+std::optional<std::vector<instruction_t>>
+decode(std::span<const std::byte> bytes, std::size_t reach);
+
+/**
+ * How many times each run of two or three ops fell through from one to the
+ * next, indexed by the ops in order with a pair's third halt, which never
+ * falls through; a run that does often is worth fusing.
+ */
+using sequence_counts_t = std::array<
+    std::array<std::array<std::uint64_t, op_codes>, op_codes>, op_codes>;
+
+/**
+ * Execute instructions on a tape of Cell (see with_cell), adding one to
+ * hits, by index, each time one runs, and to sequences each time one falls
+ * through to the next rather than jumping. Far slower than a machine; it's
+ * for profiling.
+ */
+template <typename Cell = std::uint8_t>
+void profile(std::span<const instruction_t> instructions, std::byte *pointer,
+             output_t &output, input_t &input, std::span<std::uint64_t> hits,
+             sequence_counts_t &sequences);
+
+/**
+ * Execute instructions on a tape of Cell from position from, checking
+ * suspend at each back edge taken; returns where it stopped, or nullopt
+ * once it's finished. Plain dispatch from a switch, for machines to fall
+ * back on when a run may have to stop part way.
+ */
+template <typename Cell = std::uint8_t>
+std::optional<position_t> run(std::span<const instruction_t> instructions,
+                              std::byte *tape, position_t from,
+                              output_t &output, input_t &input,
+                              suspend_t &suspend);
+
+/**
+ * A variable length encoding of instructions, around a quarter of their
+ * size, for an interpreter to run. Each instruction is an op byte, its
+ * op_code_t or'd with wide when its offset or operand needs 32 bits rather
+ * than 8, then the value of a dadd, set or madd, as wide as a cell, or all
+ * four bytes of a puts', then the offset and operand the op uses, signed
+ * and little endian. A jump's
+ * operand is the distance in bytes from the jump to just past the other
+ * end of its loop. The code ends with a halt.
+ *
+ * Runs of instructions in superinstructions are fused into one: op byte
+ * fused plus the run's index, or'd with wide if any needs it, then the
+ * fields of each in turn. A jump last in a run is measured from the byte
+ * before its fields as if that were its op byte.
+ */
+namespace compact {
+
+inline constexpr std::uint8_t wide = 0x10;
+inline constexpr std::uint8_t fused = 0x20;
+
+/**
+ * Up to three ops run one after another, a pair's third halt.
+ */
+using sequence_t = std::array<op_code_t, 3>;
+
+constexpr std::size_t length(const sequence_t &ops) {
+  return ops[2] == op_code_t::halt ? 2 : 3;
+}
+
+/**
+ * The pairs then the triples that fall through most often running the
+ * ccbf-bench corpus, per ccbf-bench -p, each most first; code is fused into
+ * as few of them and single instructions as it can be. Only the last op of
+ * one may be a jump, so no jump's target is inside one. There's an op byte
+ * for each of up to wide of them.
+ */
+inline constexpr sequence_t superinstructions[] = {
+    {op_code_t::madd, op_code_t::set, op_code_t::halt},
+    {op_code_t::padd, op_code_t::njmp, op_code_t::halt},
+    {op_code_t::set, op_code_t::padd, op_code_t::halt},
+    {op_code_t::dadd, op_code_t::madd, op_code_t::halt},
+    {op_code_t::set, op_code_t::madd, op_code_t::halt},
+    {op_code_t::madd, op_code_t::madd, op_code_t::halt},
+    {op_code_t::dadd, op_code_t::padd, op_code_t::halt},
+    {op_code_t::padd, op_code_t::zjmp, op_code_t::halt},
+    {op_code_t::madd, op_code_t::set, op_code_t::padd},
+    {op_code_t::set, op_code_t::padd, op_code_t::njmp},
+    {op_code_t::madd, op_code_t::set, op_code_t::madd},
+    {op_code_t::madd, op_code_t::madd, op_code_t::set},
+    {op_code_t::dadd, op_code_t::madd, op_code_t::set},
+    {op_code_t::set, op_code_t::madd, op_code_t::madd},
+    {op_code_t::dadd, op_code_t::padd, op_code_t::njmp},
+    {op_code_t::set, op_code_t::dadd, op_code_t::padd},
+};
+static_assert(std::size(superinstructions) <= wide);
+
+constexpr bool has_value(op_code_t op) {
+  return op == op_code_t::dadd || op == op_code_t::puts ||
+         op == op_code_t::set || op == op_code_t::madd;
+}
+
+constexpr bool has_offset(op_code_t op) {
+  return op == op_code_t::dadd || op == op_code_t::putc ||
+         op == op_code_t::getc || op == op_code_t::set ||
+         op == op_code_t::madd;
+}
+
+constexpr bool has_operand(op_code_t op) {
+  return op == op_code_t::padd || op == op_code_t::zjmp ||
+         op == op_code_t::njmp || op == op_code_t::puts ||
+         op == op_code_t::madd || op == op_code_t::scan;
+}
+
+/**
+ * The size of an instruction's value, for cells of cell_size bytes.
+ */
+constexpr std::size_t value_size(op_code_t op, std::size_t cell_size = 1) {
+  return !has_value(op)          ? 0
+         : op == op_code_t::puts ? sizeof(std::int32_t)
+                                 : cell_size;
+}
+
+/**
+ * The size of an instruction whose offset and operand are width bytes, for
+ * cells of cell_size bytes.
+ */
+constexpr std::size_t size(op_code_t op, std::size_t width,
+                           std::size_t cell_size = 1) {
+  return 1 + value_size(op, cell_size) +
+         width * (has_offset(op) + has_operand(op));
+}
+
+std::vector<std::byte> encode(std::span<const instruction_t> instructions,
+                              std::size_t cell_size = 1);
+
+} // namespace compact
+
+} // namespace brainfk::bytecode
+
+#endif // BRAINFK_BYTECODE_HPP
@@ -0,0 +1,133 @@
+#include "cache.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <format>
+#include <fstream>
+#include <iterator>
+#include <system_error>
+
+#include <unistd.h>
+
+namespace {
+
+__extension__ using uint128_t = unsigned __int128;
+
+/**
+ * 128 bit FNV-1a; stable across builds and platforms, unlike std::hash.
+ */
+class fnv_t {
+public:
+  void update(char c) {
+    hash_ ^= std::uint8_t(c);
+    hash_ *= prime;
+  }
+
+  void update(std::string_view s) {
+    for (auto c : s)
+      update(c);
+  }
+
+  std::string hex() const {
+    return std::format("{:016x}{:016x}", std::uint64_t(hash_ >> 64),
+                       std::uint64_t(hash_));
+  }
+
+private:
+  static constexpr uint128_t prime =
+      (uint128_t(0x0000000001000000) << 64) + 0x000000000000013b;
+
+  uint128_t hash_ =
+      (uint128_t(0x6c62272e07bb0142) << 64) + 0x62b821756295c58d;
+};
+
+} // namespace
+
+std::optional<std::filesystem::path>
+brainfk::code_cache_t::default_directory() {
+  if (const auto xdg = std::getenv("XDG_CACHE_HOME"); xdg && *xdg)
+    return std::filesystem::path(xdg) / "ccbf";
+  if (const auto home = std::getenv("HOME"); home && *home)
+    return std::filesystem::path(home) / ".cache" / "ccbf";
+  return std::nullopt;
+}
+
+std::string
+brainfk::code_cache_t::key(std::string_view program,
+                           std::initializer_list<std::string_view> settings) {
+  fnv_t fnv;
+  for (auto c : program) {
+    switch (c) {
+    case '+':
+    case '-':
+    case '>':
+    case '<':
+    case '.':
+    case ',':
+    case '[':
+    case ']':
+      fnv.update(c);
+      break;
+    default:
+      break;
+    }
+  }
+  // separate each part so ("ab", "c") and ("a", "bc") differ
+  for (auto setting : settings) {
+    fnv.update('\0');
+    fnv.update(setting);
+  }
+  return fnv.hex();
+}
+
+std::optional<std::vector<std::byte>>
+brainfk::code_cache_t::load(const std::string &key) const {
+  std::ifstream in{path(key), std::ios::binary};
+  if (!in)
+    return std::nullopt;
+
+  std::vector<char> bytes{std::istreambuf_iterator<char>(in),
+                          std::istreambuf_iterator<char>()};
+  if (in.bad())
+    return std::nullopt;
+
+  std::vector<std::byte> result(bytes.size());
+  std::ranges::transform(bytes, result.begin(),
+                         [](char c) { return std::byte(c); });
+  return result;
+}
+
+void brainfk::code_cache_t::store(const std::string &key,
+                                  std::span<const std::byte> code) const {
+  const auto target = path(key);
+  std::error_code ec;
+  std::filesystem::create_directories(target.parent_path(), ec);
+  if (ec)
+    return;
+
+  // unique across processes and threads sharing the directory
+  static std::atomic<std::uint64_t> stores;
+  auto temporary = target;
+  temporary += std::format(".{}.{}.tmp", ::getpid(), stores++);
+  {
+    std::ofstream out{temporary, std::ios::binary | std::ios::trunc};
+    out.write(reinterpret_cast<const char *>(code.data()),
+              std::streamsize(code.size()));
+    if (!out.flush()) {
+      out.close();
+      std::filesystem::remove(temporary, ec);
+      return;
+    }
+  }
+
+  std::filesystem::rename(temporary, target, ec);
+  if (ec)
+    std::filesystem::remove(temporary, ec);
+}
+
+std::filesystem::path
+brainfk::code_cache_t::path(const std::string &key) const {
+  return directory_ / key.substr(0, 2) / key.substr(2);
+}
@@ -0,0 +1,53 @@
+#ifndef BRAINFK_CACHE_HPP
+#define BRAINFK_CACHE_HPP
+
+#include <cstddef>
+#include <filesystem>
+#include <initializer_list>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace brainfk {
+
+/**
+ * A content addressed store of compiled code on disk, one file per key in
+ * a two level tree like ccache's. It's only an optimization so failing to
+ * read or write an entry is never an error; entries are written to a
+ * temporary file then renamed so concurrent runs can share a directory.
+ */
+class code_cache_t {
+public:
+  explicit code_cache_t(std::filesystem::path directory)
+      : directory_(std::move(directory)) {}
+
+  /**
+   * $XDG_CACHE_HOME/ccbf, falling back to $HOME/.cache/ccbf; nothing when
+   * neither is set, rather than a shared directory other users could plant
+   * code in.
+   */
+  static std::optional<std::filesystem::path> default_directory();
+
+  /**
+   * The key of program compiled with settings (the machine, its code format
+   * version, optimization level, CPU etc): a 128 bit hash of the program's
+   * brainfk characters, so comments and layout don't matter, and settings.
+   */
+  static std::string key(std::string_view program,
+                         std::initializer_list<std::string_view> settings);
+
+  std::optional<std::vector<std::byte>> load(const std::string &key) const;
+
+  void store(const std::string &key, std::span<const std::byte> code) const;
+
+private:
+  std::filesystem::path path(const std::string &key) const;
+
+  std::filesystem::path directory_;
+};
+
+} // namespace brainfk
+
+#endif // BRAINFK_CACHE_HPP
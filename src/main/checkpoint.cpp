@@ -0,0 +1,248 @@
+#include "checkpoint.hpp"
+#include "bytecode.hpp"
+#include "cache.hpp"
+#include "ir.hpp"
+#include "machine.hpp"
+#include "tape.hpp"
+
+#include <algorithm>
+#include <format>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <system_error>
+
+#include <unistd.h>
+
+namespace {
+
+constexpr std::string_view magic = "ccbfckp1";
+
+/**
+ * Appends the fields of a checkpoint file.
+ */
+class writer_t {
+public:
+  void varint(std::uint64_t n) {
+    for (; n >= 0x80; n >>= 7)
+      bytes_.push_back(char((n & 0x7f) | 0x80));
+    bytes_.push_back(char(n));
+  }
+
+  // zigzag, so small negative numbers stay short
+  void signed_varint(std::int64_t n) {
+    varint((std::uint64_t(n) << 1) ^ std::uint64_t(n >> 63));
+  }
+
+  void bytes(std::span<const std::byte> bytes) {
+    bytes_.append(reinterpret_cast<const char *>(bytes.data()),
+                  bytes.size());
+  }
+
+  void string(std::string_view s) {
+    varint(s.size());
+    bytes_ += s;
+  }
+
+  const std::string &str() const { return bytes_; }
+
+private:
+  std::string bytes_{magic};
+};
+
+/**
+ * Reads the fields back, throwing if the file ends among them.
+ */
+class reader_t {
+public:
+  reader_t(std::string_view bytes, const std::filesystem::path &path)
+      : bytes_(bytes), path_(path) {
+    if (!bytes_.starts_with(magic))
+      throw std::runtime_error{
+          std::format("{} isn't a checkpoint", path_.string())};
+    bytes_.remove_prefix(magic.size());
+  }
+
+  std::uint64_t varint() {
+    std::uint64_t result = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+      const auto byte = std::uint8_t(take(1)[0]);
+      result |= std::uint64_t(byte & 0x7f) << shift;
+      if (!(byte & 0x80))
+        return result;
+    }
+    throw corrupt();
+  }
+
+  std::int64_t signed_varint() {
+    const auto n = varint();
+    return std::int64_t(n >> 1) ^ -std::int64_t(n & 1);
+  }
+
+  std::string_view take(std::uint64_t n) {
+    if (n > bytes_.size())
+      throw corrupt();
+    const auto result = bytes_.substr(0, n);
+    bytes_.remove_prefix(n);
+    return result;
+  }
+
+  std::string string() { return std::string(take(varint())); }
+
+  bool done() const { return bytes_.empty(); }
+
+  std::runtime_error corrupt() const {
+    return std::runtime_error{
+        std::format("{} is a corrupt checkpoint", path_.string())};
+  }
+
+private:
+  std::string_view bytes_;
+  const std::filesystem::path &path_;
+};
+
+} // namespace
+
+std::optional<brainfk::position_t> brainfk::machine_t::suspendable_impl(
+    const executable_ptr_t &executable, std::byte *mem, output_t &output,
+    input_t &input, suspend_t &, position_t from) {
+  if (from != position_t{})
+    throw std::runtime_error{
+        "this machine can't start part way through a program"};
+  execute_impl(executable, mem, output, input);
+  return std::nullopt;
+}
+
+bool brainfk::machine_t::can_suspend_impl(const executable_ptr_t &) const {
+  return false;
+}
+
+std::string brainfk::checkpoint_t::key(std::string_view program) {
+  return code_cache_t::key(program, {bytecode::version});
+}
+
+std::size_t brainfk::checkpoint_t::instructions(std::string_view program) {
+  // one per node
+  return ir::evaluate(ir::compile(program)).size();
+}
+
+void brainfk::checkpoint_t::capture(const tape_t &tape) {
+  const auto all = tape.cells();
+  const auto nonzero = [](std::byte b) { return b != std::byte(0); };
+  const auto size = std::ptrdiff_t(cell_bits / 8);
+
+  // whole cells from the first one with a non-zero byte to the last
+  const auto begin = std::ranges::find_if(all, nonzero);
+  if (begin == all.end()) {
+    first = 0;
+    cells.clear();
+    return;
+  }
+  const auto end = std::ranges::find_if(all.rbegin(), all.rend(), nonzero);
+  const auto from = (begin - all.begin()) / size * size;
+  const auto to = (all.rend() - end + size - 1) / size * size;
+
+  first = (all.data() + from - tape.data()) / size;
+  cells.assign(all.begin() + from, all.begin() + to);
+}
+
+void brainfk::checkpoint_t::restore(const tape_t &tape,
+                                    std::size_t instructions) const {
+  // the tape's cells from where the program started, compared as numbers
+  // since a corrupt checkpoint's may be anywhere
+  const auto all = tape.cells();
+  const auto size = std::ptrdiff_t(cell_bits / 8);
+  const auto low = (all.data() - tape.data()) / size;
+  const auto high = (all.data() + all.size() - tape.data()) / size;
+  if (first < low || first > high ||
+      std::size_t(high - first) * std::size_t(size) < cells.size())
+    throw std::runtime_error{
+        std::format("the checkpoint's cells from {} don't fit the tape",
+                    first)};
+  if (position.cell < low || position.cell >= high)
+    throw std::runtime_error{std::format(
+        "the checkpoint's cell {} is off the tape", position.cell)};
+  if (position.pc > instructions)
+    throw std::runtime_error{
+        std::format("the checkpoint's instruction {} is past the program's {}",
+                    position.pc, instructions)};
+  std::ranges::copy(cells, tape.data() + first * size);
+}
+
+void brainfk::checkpoint_t::save(const std::filesystem::path &path) const {
+  writer_t writer;
+  writer.string(program_key);
+  writer.varint(cell_bits);
+  writer.varint(position.pc);
+  writer.signed_varint(position.cell);
+  writer.varint(input);
+  writer.signed_varint(first);
+  writer.varint(cells.size());
+
+  // alternate runs of zeros and of other bytes, by their lengths
+  const std::span<const std::byte> rest{cells};
+  const auto zero = [](std::byte b) { return b == std::byte(0); };
+  for (auto i = rest.begin(); i != rest.end();) {
+    const auto zeros = std::find_if_not(i, rest.end(), zero);
+    const auto others = std::find_if(zeros, rest.end(), zero);
+    writer.varint(std::uint64_t(zeros - i));
+    writer.varint(std::uint64_t(others - zeros));
+    writer.bytes({zeros, others});
+    i = others;
+  }
+
+  auto temporary = path;
+  temporary += std::format(".{}.tmp", ::getpid());
+  {
+    std::ofstream out{temporary, std::ios::binary | std::ios::trunc};
+    out.write(writer.str().data(), std::streamsize(writer.str().size()));
+    if (!out.flush()) {
+      out.close();
+      std::error_code ec;
+      std::filesystem::remove(temporary, ec);
+      throw std::runtime_error{
+          std::format("can't write {}", temporary.string())};
+    }
+  }
+  std::filesystem::rename(temporary, path);
+}
+
+brainfk::checkpoint_t
+brainfk::checkpoint_t::load(const std::filesystem::path &path) {
+  std::ifstream in{path, std::ios::binary};
+  if (!in)
+    throw std::runtime_error{std::format("can't open {}", path.string())};
+  const std::string bytes{std::istreambuf_iterator<char>(in),
+                          std::istreambuf_iterator<char>()};
+  if (in.bad())
+    throw std::runtime_error{std::format("can't read {}", path.string())};
+
+  reader_t reader{bytes, path};
+  checkpoint_t result;
+  result.program_key = reader.string();
+  result.cell_bits = unsigned(reader.varint());
+  result.position.pc = std::size_t(reader.varint());
+  result.position.cell = std::ptrdiff_t(reader.signed_varint());
+  result.input = reader.varint();
+  result.first = std::ptrdiff_t(reader.signed_varint());
+
+  // each run must fill some of the cells, and none past the end
+  const auto size = reader.varint();
+  while (result.cells.size() < size) {
+    const auto zeros = reader.varint();
+    const auto others = reader.take(reader.varint());
+    if (zeros + others.size() > size - result.cells.size() ||
+        !(zeros + others.size()))
+      throw reader.corrupt();
+    result.cells.resize(result.cells.size() + zeros);
+    std::ranges::transform(others, std::back_inserter(result.cells),
+                           [](char c) { return std::byte(c); });
+  }
+  if (!reader.done())
+    throw reader.corrupt();
+
+  with_cell(result.cell_bits, [](auto) {});
+  if (result.cells.size() % (result.cell_bits / 8))
+    throw reader.corrupt();
+  return result;
+}
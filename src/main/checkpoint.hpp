@@ -0,0 +1,118 @@
+#ifndef BRAINFK_CHECKPOINT_HPP
+#define BRAINFK_CHECKPOINT_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace brainfk {
+
+class tape_t;
+
+/**
+ * Where a suspended execution stopped: the next instruction, by its index in
+ * the bytecode machines lower a program to (one per node of
+ * ir::evaluate(ir::compile(program))), and the tape pointer in cells from
+ * where the program started. It's the same whichever machine stopped there.
+ */
+struct position_t {
+  std::size_t pc = 0;
+  std::ptrdiff_t cell = 0;
+
+  bool operator==(const position_t &) const = default;
+};
+
+/**
+ * Asks an execution to stop at the next back edge of a loop it takes, once
+ * request() has been called or it has taken steps of them.
+ */
+class suspend_t {
+public:
+  explicit suspend_t(
+      std::uint64_t steps = std::numeric_limits<std::uint64_t>::max())
+      : steps_(steps) {}
+
+  /**
+   * Safe to call from a signal handler or another thread.
+   */
+  void request() { requested_.store(true, std::memory_order_relaxed); }
+
+  /**
+   * Count a back edge; true once the execution should stop.
+   */
+  bool due() {
+    if (requested_.load(std::memory_order_relaxed) || !steps_)
+      return true;
+    --steps_;
+    return false;
+  }
+
+private:
+  static_assert(std::atomic<bool>::is_always_lock_free);
+
+  std::atomic<bool> requested_{false};
+  std::uint64_t steps_;
+};
+
+/**
+ * A suspended execution, enough to carry on with in another process,
+ * perhaps on another machine: the program's key, its cell width and position,
+ * how many bytes of input it had read and the tape from its first non-zero
+ * byte to its last.
+ */
+struct checkpoint_t {
+  /**
+   * Identifies program, and the bytecode its position is in, so a
+   * checkpoint can't be resumed with another.
+   */
+  static std::string key(std::string_view program);
+
+  /**
+   * How many instructions program lowers to, past which no position's pc
+   * can be.
+   */
+  static std::size_t instructions(std::string_view program);
+
+  /**
+   * key(program), rather than the program itself.
+   */
+  std::string program_key;
+  unsigned cell_bits = 8;
+  position_t position;
+  std::uint64_t input = 0;
+  /**
+   * The cell cells starts at, from where the program started.
+   */
+  std::ptrdiff_t first = 0;
+  std::vector<std::byte> cells;
+
+  /**
+   * Take first and cells from tape, which has cells of cell_bits.
+   */
+  void capture(const tape_t &tape);
+
+  /**
+   * Write cells back onto tape, a zeroed tape of cells of cell_bits, for a
+   * program of instructions(program) instructions; throws
+   * std::runtime_error if the cells or the position don't fit.
+   */
+  void restore(const tape_t &tape, std::size_t instructions) const;
+
+  /**
+   * The file holds the fields as varints and the cells as runs of zero
+   * bytes, by their length, and of the other bytes, so a sparse tape takes
+   * little space. It's replaced by renaming so it's never left half
+   * written. Both throw std::runtime_error on failure.
+   */
+  void save(const std::filesystem::path &path) const;
+  static checkpoint_t load(const std::filesystem::path &path);
+};
+
+} // namespace brainfk
+
+#endif // BRAINFK_CHECKPOINT_HPP
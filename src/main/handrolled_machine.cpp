@@ -1,165 +1,355 @@
 #include "handrolled_machine.hpp"
-#include "util.hpp"
+#include "bytecode.hpp"
+#include "cache.hpp"
+#include "ir.hpp"
+#include "scan.hpp"
+#include "tape.hpp"
 
-#include <cassert>
 #include <cstdint>
-#include <format>
-#include <ranges>
+#include <cstring>
+#include <iterator>
+#include <optional>
 #include <span>
-#include <utility>
+#include <type_traits>
 #include <vector>
 
 namespace {
 
-enum class op_code_t : std::uint8_t {
-  padd, // move pointer by signed offset
-  dadd, // (de|in)crement by signed value
-  zjmp, // jump to a signed offset if zero
-  njmp, // jump to a signed offset if non-zero
-  putc, // output the current byte
-  getc, // input into the current byte
-  zero, // set 1 or more bytes to zero
-};
+using brainfk::bytecode::instruction_t;
+using brainfk::bytecode::op_code_t;
 
-struct instruction_t {
-  op_code_t op_code;
+/**
+ * An instruction in direct threaded code: handler is the offset of the
+ * instruction's label from the start of run_threaded's dispatch table, which
+ * keeps the instruction to 16 bytes instead of 24 with a full pointer.
+ */
+struct threaded_instruction_t {
+  std::int32_t handler;
+  std::int32_t value;
+  std::int32_t offset;
   std::int32_t operand;
 };
 
+// labels as values and computed goto are GNU extensions
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#ifdef __clang__
+#pragma clang diagnostic ignored "-Wgnu-label-as-value"
+#endif
+
+/**
+ * Execute threaded code starting at ip on a tape of Cell; each handler
+ * jumps straight to the next instruction's handler so there is no loop
+ * bounds check and a separate indirect branch per handler. Code must end
+ * with a halt.
+ *
+ * Called with a null ip, returns the handler table indexed by op_code_t
+ * instead; that's the only way to take the labels' addresses.
+ */
+template <typename Cell>
+const std::int32_t *run_threaded(const threaded_instruction_t *ip,
+                                 std::byte *tape, brainfk::output_t *output,
+                                 brainfk::input_t *input) {
+#define HANDLER(label)                                                         \
+  std::int32_t(static_cast<char *>(&&label) - static_cast<char *>(&&padd))
+
+  static const std::int32_t handlers[] = {
+      HANDLER(padd), HANDLER(dadd), HANDLER(zjmp), HANDLER(njmp),
+      HANDLER(putc), HANDLER(puts), HANDLER(getc), HANDLER(set),
+      HANDLER(madd), HANDLER(scan), HANDLER(halt),
+  };
+  static_assert(std::size(handlers) == std::size_t(op_code_t::halt) + 1);
+
+  if (ip == nullptr)
+    return handlers;
+
+  auto pointer_ = reinterpret_cast<Cell *>(tape);
+
+#define DISPATCH() goto *(static_cast<char *>(&&padd) + ip->handler)
+#define NEXT()                                                                 \
+  do {                                                                         \
+    ++ip;                                                                      \
+    DISPATCH();                                                                \
+  } while (false)
+
+  DISPATCH();
+
+padd:
+  std::advance(pointer_, ip->operand);
+  NEXT();
+dadd:
+  pointer_[ip->offset] = Cell(pointer_[ip->offset] + Cell(ip->value));
+  NEXT();
+zjmp:
+  if (!*pointer_)
+    ip += ip->operand;
+  NEXT();
+njmp:
+  if (*pointer_)
+    ip += ip->operand;
+  NEXT();
+putc:
+  output->put(std::byte(pointer_[ip->offset]));
+  NEXT();
+puts:
+  for (std::int32_t i = 0; i < ip->operand; ++i)
+    output->put(brainfk::ir::written(ip->value, std::size_t(i)));
+  NEXT();
+getc:
+  pointer_[ip->offset] = input->get(pointer_[ip->offset]);
+  NEXT();
+set:
+  pointer_[ip->offset] = Cell(ip->value);
+  NEXT();
+madd:
+  if (const auto factor = unsigned(pointer_[ip->operand]))
+    pointer_[ip->offset] =
+        Cell(pointer_[ip->offset] + factor * unsigned(ip->value));
+  NEXT();
+scan:
+  pointer_ = brainfk::scan(pointer_, ip->operand);
+  NEXT();
+halt:
+  return nullptr;
+
+#undef NEXT
+#undef DISPATCH
+#undef HANDLER
+}
+
+#pragma GCC diagnostic pop
+
+template <typename T> T load(const std::byte *p) {
+  T result;
+  std::memcpy(&result, p, sizeof result);
+  return result;
+}
+
+/**
+ * Execute the compact instruction at ip, whose offset and operand are
+ * Operand wide, on a tape of Cell and return the next. Each op and width
+ * has its own case in the switch loop, so decoding takes no branches of its
+ * own.
+ */
+template <op_code_t op, typename Operand, typename Cell>
+[[gnu::always_inline]] inline const std::byte *
+step(const std::byte *ip, Cell *&pointer_, brainfk::output_t &output,
+     brainfk::input_t &input) {
+  namespace compact = brainfk::bytecode::compact;
+  constexpr auto value_at = 1;
+  constexpr auto offset_at = value_at + compact::value_size(op, sizeof(Cell));
+  constexpr auto operand_at =
+      offset_at + compact::has_offset(op) * sizeof(Operand);
+  constexpr auto size = compact::size(op, sizeof(Operand), sizeof(Cell));
+
+  // only read what the op has; the others may be past the end of the code
+  using value_t =
+      std::conditional_t<op == op_code_t::puts, std::int32_t, Cell>;
+  const auto value = compact::has_value(op) ? load<value_t>(ip + value_at) : 0;
+  const auto offset = compact::has_offset(op)
+                          ? std::ptrdiff_t(load<Operand>(ip + offset_at))
+                          : 0;
+  const auto operand = compact::has_operand(op)
+                           ? std::ptrdiff_t(load<Operand>(ip + operand_at))
+                           : 0;
+
+  if constexpr (op == op_code_t::padd) {
+    std::advance(pointer_, operand);
+  } else if constexpr (op == op_code_t::dadd) {
+    pointer_[offset] = Cell(pointer_[offset] + value);
+  } else if constexpr (op == op_code_t::zjmp) {
+    return ip + (!*pointer_ ? operand : size);
+  } else if constexpr (op == op_code_t::njmp) {
+    return ip + (*pointer_ ? operand : size);
+  } else if constexpr (op == op_code_t::putc) {
+    output.put(std::byte(pointer_[offset]));
+  } else if constexpr (op == op_code_t::puts) {
+    for (std::ptrdiff_t i = 0; i < operand; ++i)
+      output.put(brainfk::ir::written(value, std::size_t(i)));
+  } else if constexpr (op == op_code_t::getc) {
+    pointer_[offset] = input.get(pointer_[offset]);
+  } else if constexpr (op == op_code_t::set) {
+    pointer_[offset] = Cell(value);
+  } else if constexpr (op == op_code_t::madd) {
+    if (const auto factor = unsigned(pointer_[operand]))
+      pointer_[offset] = Cell(pointer_[offset] + factor * unsigned(value));
+  } else if constexpr (op == op_code_t::scan) {
+    pointer_ = brainfk::scan(pointer_, operand);
+  }
+  return ip + size;
+}
+
+/**
+ * Execute the superinstruction at ip, the kth, from its jth op on and
+ * return the next; each op after the first has its fields follow the one
+ * before's as if after an op byte of its own.
+ */
+template <std::size_t k, typename Operand, std::size_t j = 0, typename Cell>
+[[gnu::always_inline]] inline const std::byte *
+fused(const std::byte *ip, Cell *&pointer_, brainfk::output_t &output,
+      brainfk::input_t &input) {
+  namespace compact = brainfk::bytecode::compact;
+  constexpr auto ops = compact::superinstructions[k];
+
+  // all but the last are never jumps so always fall through to the next
+  ip = step<ops[j], Operand>(j ? ip - 1 : ip, pointer_, output, input);
+  if constexpr (j + 1 < compact::length(ops))
+    return fused<k, Operand, j + 1>(ip, pointer_, output, input);
+  else
+    return ip;
+}
+
 struct executable_t : public brainfk::executable_t {
-  explicit executable_t(std::string_view program) {
-    // this regex has 3 mutually exclusive groups:
-    // 1: a sequence of one or more [-]> blocks (set to zero & advance pointer)
-    // 2: a single [-] block (set to zero)
-    // 3: a sequence of:
-    //      one or more >; or // move pointer right by number of instructions
-    //      one or more <; or // move pointer left by number of instructions
-    //      one or more +; or // increment by the number of instructions
-    //      one or more -; or // decrement by the number of instructions
-    //      one of .,[]
-    static const std::regex re{
-        R"xx(((?:\[-]>)+)|(\[-])|(>+|<+|\++|-+|[.,[\]]))xx"};
-
-    // filter non-instruction characters from the input
-    auto filtered = program | std::ranges::views::filter([](auto c) {
-                      static constexpr std::string_view bf_alphabet =
-                          "+-<>[],.";
-                      return bf_alphabet.contains(c);
-                    });
-
-    using it_t = std::regex_iterator<decltype(filtered.begin())>;
-
-    // the stack contains a 2-tuple of:
-    // 0: the index of a zjmp instruction in result; and
-    // 1: the index of its corresponding [ instruction in the input
-    std::stack<std::tuple<std::int32_t, std::uint32_t>> stack;
-    for (it_t i{filtered.begin(), filtered.end(), re}, e; i != e; ++i) {
-      auto &m = *i;
-      if (m[1].matched) {
-        instructions_.emplace_back(op_code_t::zero,
-                                   std::distance(m[1].first, m[1].second) / 4);
-      } else if (m[2].matched) {
-        instructions_.emplace_back(op_code_t::zero, 0);
-      } else {
-        assert(m[3].matched);
-        const auto input_pos = std::distance(filtered.begin(), m[3].first);
-        switch (*m[3].first) {
-        case '>':
-          instructions_.emplace_back(op_code_t::padd,
-                                     std::distance(m[3].first, m[3].second));
-          break;
-        case '<':
-          instructions_.emplace_back(op_code_t::padd,
-                                     -std::distance(m[3].first, m[3].second));
-          break;
-        case '+':
-          instructions_.emplace_back(op_code_t::dadd,
-                                     std::distance(m[3].first, m[3].second));
-          break;
-        case '-':
-          instructions_.emplace_back(op_code_t::dadd,
-                                     -std::distance(m[3].first, m[3].second));
-          break;
-        case '.':
-          instructions_.emplace_back(op_code_t::putc, 0);
-          break;
-        case ',':
-          instructions_.emplace_back(op_code_t::getc, 0);
-          break;
-        case '[':
-          stack.emplace(std::int32_t(instructions_.size()), input_pos);
-          instructions_.emplace_back(op_code_t::zjmp, 0);
-          break;
-        case ']':
-          if (stack.empty()) {
-            throw std::runtime_error{
-                std::format("malformed program: unmatched ']' at {}",
-                            std::distance(filtered.begin(), m[3].first))};
-          }
-          instructions_[std::get<0>(stack.top())].operand =
-              std::int32_t(instructions_.size()) - std::get<0>(stack.top());
-          instructions_.emplace_back(op_code_t::njmp,
-                                     std::get<0>(stack.top()) -
-                                         std::int32_t(instructions_.size()));
-          stack.pop();
-          break;
-        default:
-          std::unreachable();
-        }
-      }
-    }
-    if (!stack.empty()) {
-      throw std::runtime_error(std::format(
-          "malformed program: unmatched '[' at {}", std::get<1>(stack.top())));
+  virtual void operator()(std::byte *tape, brainfk::output_t &output,
+                          brainfk::input_t &input) const = 0;
+
+  /**
+   * A run that may stop part way, on the plain bytecode interpreter so the
+   * fast paths needn't check for it.
+   */
+  virtual std::optional<brainfk::position_t>
+  operator()(std::byte *tape, brainfk::position_t from,
+             brainfk::output_t &output, brainfk::input_t &input,
+             brainfk::suspend_t &suspend) const = 0;
+};
+
+/**
+ * Code for cells of Cell. Nothing is written after construction; a run's
+ * state is local to operator() or run_threaded, so runs on several threads
+ * don't interact.
+ */
+template <typename Cell> struct cell_executable_t final : executable_t {
+  using dispatch_t = brainfk::handrolled_machine_t::dispatch_t;
+
+  cell_executable_t(std::span<const instruction_t> instructions,
+                    dispatch_t dispatch)
+      : instructions_(instructions.begin(), instructions.end()) {
+    if (dispatch == dispatch_t::switch_loop) {
+      code_ = brainfk::bytecode::compact::encode(instructions, sizeof(Cell));
+      return;
     }
+
+    // resolve each op_code to its handler up front
+    const auto handlers = run_threaded<Cell>(nullptr, nullptr, nullptr, {});
+    threaded_.reserve(instructions.size() + 1);
+    for (const auto &i : instructions)
+      threaded_.emplace_back(handlers[std::size_t(i.op_code)], i.value,
+                             i.offset, i.operand);
+    threaded_.emplace_back(handlers[std::size_t(op_code_t::halt)], 0, 0, 0);
   }
 
-  void operator()(std::byte *pointer_, const brainfk::putc_t &putc,
-                  const brainfk::getc_t &getc) const {
-    for (auto i = instructions_.begin(), e = instructions_.end(); i != e; ++i) {
-      switch (i->op_code) {
-      case op_code_t::padd:
-        std::advance(pointer_, i->operand);
-        break;
-      case op_code_t::dadd:
-        *pointer_ = std::byte(std::int32_t(*pointer_) + i->operand);
-        break;
-      case op_code_t::zjmp:
-        if (*pointer_ == std::byte(0))
-          std::advance(i, i->operand);
-        break;
-      case op_code_t::njmp:
-        if (*pointer_ != std::byte(0))
-          std::advance(i, i->operand);
-        break;
-      case op_code_t::putc:
-        putc(*pointer_);
-        break;
-      case op_code_t::getc:
-        *pointer_ = getc();
-        break;
-      case op_code_t::zero:
-        if (i->operand)
-          pointer_ = std::fill_n(pointer_, i->operand, std::byte(0));
-        else
-          *pointer_ = std::byte(0);
-        break;
+  void operator()(std::byte *tape, brainfk::output_t &output,
+                  brainfk::input_t &input) const override {
+    if (!threaded_.empty()) {
+      run_threaded<Cell>(threaded_.data(), tape, &output, &input);
+      return;
+    }
+
+    using brainfk::bytecode::compact::fused;
+    using brainfk::bytecode::compact::wide;
+#define CASES(op)                                                              \
+  case std::uint8_t(op_code_t::op):                                            \
+    ip = step<op_code_t::op, std::int8_t>(ip, pointer_, output, input);        \
+    break;                                                                     \
+  case std::uint8_t(op_code_t::op) | wide:                                     \
+    ip = step<op_code_t::op, std::int32_t>(ip, pointer_, output, input);       \
+    break
+    // a case for every op byte a superinstruction could have, those past
+    // the end of the table never encoded
+    constexpr auto defined =
+        std::size(brainfk::bytecode::compact::superinstructions);
+#define FUSED_CASES(k)                                                         \
+  case fused + k:                                                              \
+    if constexpr (k < defined)                                                 \
+      ip = ::fused<k, std::int8_t>(ip, pointer_, output, input);               \
+    break;                                                                     \
+  case (fused + k) | wide:                                                     \
+    if constexpr (k < defined)                                                 \
+      ip = ::fused<k, std::int32_t>(ip, pointer_, output, input);              \
+    break
+#define FUSED_CASES_4(k)                                                       \
+  FUSED_CASES(k);                                                              \
+  FUSED_CASES(k + 1);                                                          \
+  FUSED_CASES(k + 2);                                                          \
+  FUSED_CASES(k + 3)
+    static_assert(wide == 16);
+
+    auto pointer_ = reinterpret_cast<Cell *>(tape);
+    for (auto ip = code_.data();;) {
+      switch (std::uint8_t(*ip)) {
+        CASES(padd);
+        CASES(dadd);
+        CASES(zjmp);
+        CASES(njmp);
+        CASES(putc);
+        CASES(puts);
+        CASES(getc);
+        CASES(set);
+        CASES(madd);
+        CASES(scan);
+        FUSED_CASES_4(0);
+        FUSED_CASES_4(4);
+        FUSED_CASES_4(8);
+        FUSED_CASES_4(12);
+      default:
+        return;
       }
     }
+
+#undef FUSED_CASES_4
+#undef FUSED_CASES
+#undef CASES
+  }
+
+  std::optional<brainfk::position_t>
+  operator()(std::byte *tape, brainfk::position_t from,
+             brainfk::output_t &output, brainfk::input_t &input,
+             brainfk::suspend_t &suspend) const override {
+    return brainfk::bytecode::run<Cell>(instructions_, tape, from, output,
+                                        input, suspend);
   }
 
   std::vector<instruction_t> instructions_;
+  std::vector<std::byte> code_;
+  std::vector<threaded_instruction_t> threaded_;
 };
 
 } // namespace
 
 brainfk::machine_t::executable_ptr_t
 brainfk::handrolled_machine_t::compile_impl(std::string_view program) {
-  return std::make_unique<::executable_t>(program);
+  // both dispatch modes and every cell width run the same bytecode
+  const auto cache = this->cache();
+  const auto key =
+      cache ? code_cache_t::key(program, {bytecode::version}) : "";
+
+  std::optional<std::vector<bytecode::instruction_t>> instructions;
+  if (cache) {
+    if (auto bytes = cache->load(key))
+      instructions = bytecode::decode(*bytes, tape_t::reach(program));
+  }
+  if (!instructions) {
+    instructions = bytecode::lower(ir::evaluate(ir::compile(program)));
+    if (cache)
+      cache->store(key, bytecode::encode(*instructions));
+  }
+
+  return with_cell(cell_bits(), [&]<typename Cell>(std::type_identity<Cell>)
+                                    -> executable_ptr_t {
+    return std::make_unique<cell_executable_t<Cell>>(*instructions, dispatch_);
+  });
 }
 
 void brainfk::handrolled_machine_t::execute_impl(
     const brainfk::machine_t::executable_ptr_t &exe, std::byte *mem,
-    const brainfk::putc_t &putc, const brainfk::getc_t &getc) {
-  dynamic_cast<const ::executable_t &>(*exe)(mem, putc, getc);
+    brainfk::output_t &output, brainfk::input_t &input) {
+  dynamic_cast<const ::executable_t &>(*exe)(mem, output, input);
+}
+
+std::optional<brainfk::position_t>
+brainfk::handrolled_machine_t::suspendable_impl(
+    const executable_ptr_t &exe, std::byte *mem, output_t &output,
+    input_t &input, suspend_t &suspend, position_t from) {
+  return dynamic_cast<const ::executable_t &>(*exe)(mem, from, output, input,
+                                                    suspend);
 }
@@ -6,10 +6,30 @@
 namespace brainfk {
 
 class handrolled_machine_t : public machine_t {
+public:
+  /**
+   * How the bytecode is dispatched: a switch in a loop over the instructions,
+   * or direct threaded code where each instruction holds its handler address.
+   */
+  enum class dispatch_t { switch_loop, threaded };
+
+  explicit handrolled_machine_t(dispatch_t dispatch = dispatch_t::switch_loop,
+                                unsigned cell_bits = 8)
+      : machine_t(cell_bits), dispatch_(dispatch) {}
+
 private:
   std::unique_ptr<executable_t> compile_impl(std::string_view) override;
   void execute_impl(const std::unique_ptr<executable_t> &, std::byte *,
-                            const putc_t &, const getc_t &) override;
+                            output_t &, input_t &) override;
+  std::optional<position_t>
+  suspendable_impl(const std::unique_ptr<executable_t> &, std::byte *,
+                   output_t &, input_t &, suspend_t &,
+                   position_t) override;
+  bool can_suspend_impl(const std::unique_ptr<executable_t> &) const override {
+    return true;
+  }
+
+  dispatch_t dispatch_;
 };
 
 }
@@ -0,0 +1,73 @@
+#include "io.hpp"
+#include "util.hpp"
+
+#include <algorithm>
+
+#include <unistd.h>
+
+void brainfk::putc_output_t::write(std::span<const std::byte> bytes) {
+  for (auto c : bytes)
+    putc_(c);
+}
+
+void brainfk::string_output_t::write(std::span<const std::byte> bytes) {
+  string_.append(reinterpret_cast<const char *>(bytes.data()), bytes.size());
+}
+
+brainfk::fd_output_t::~fd_output_t() {
+  try {
+    flush();
+  } catch (const std::exception &) {
+    // nowhere to report it
+  }
+}
+
+void brainfk::fd_output_t::write(std::span<const std::byte> bytes) {
+  while (!bytes.empty())
+    bytes = bytes.subspan(posix(::write, fd_, bytes.data(), bytes.size()));
+}
+
+bool brainfk::input_t::refill() {
+  if (tie_)
+    tie_->flush();
+
+  const auto n = read(storage_);
+  buffer_ = {storage_.data(), storage_.data() + n};
+  read_ += n;
+  return n != 0;
+}
+
+void brainfk::input_t::skip(std::uint64_t n) {
+  while (n) {
+    if (buffer_.pos == buffer_.end && !refill())
+      return;
+    const auto step =
+        std::min(n, std::uint64_t(buffer_.end - buffer_.pos));
+    buffer_.pos += step;
+    n -= step;
+  }
+}
+
+std::byte brainfk::input_t::underflow(std::byte current) {
+  if (refill())
+    return *buffer_.pos++;
+
+  switch (eof_) {
+  case eof_t::zero:
+    return std::byte(0);
+  case eof_t::minus_one:
+    return std::byte(0xff);
+  case eof_t::unchanged:
+    break;
+  }
+  return current;
+}
+
+std::size_t brainfk::getc_input_t::read(std::span<std::byte> bytes) {
+  bytes[0] = getc_();
+  return 1;
+}
+
+std::size_t brainfk::fd_input_t::read(std::span<std::byte> bytes) {
+  return posix(::read, fd_, bytes.data(), bytes.size());
+}
@@ -0,0 +1,312 @@
+#ifndef BRAINFK_IO_HPP
+#define BRAINFK_IO_HPP
+
+#include <algorithm>
+#include <array>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <span>
+#include <string>
+
+namespace brainfk {
+
+using putc_t = std::function<void(std::byte)>;
+using getc_t = std::function<std::byte()>;
+
+/**
+ * An output buffer that machines (and their generated code) write into
+ * directly; the buffered bytes are handed to write() only when the buffer
+ * fills and when flushed, e.g. at the end of a program.
+ */
+class output_t {
+public:
+  /**
+   * The part of the state that generated code updates in place: the next
+   * free byte and the end of the buffer.
+   */
+  struct buffer_t {
+    std::byte *pos;
+    std::byte *end;
+  };
+
+  output_t(const output_t &) = delete;
+  output_t &operator=(const output_t &) = delete;
+
+  virtual ~output_t() = default;
+
+  void put(std::byte c) {
+    if (buffer_.pos == buffer_.end)
+      flush();
+    *buffer_.pos++ = c;
+  }
+
+  void put(std::span<const std::byte> bytes) {
+    while (!bytes.empty()) {
+      if (buffer_.pos == buffer_.end)
+        flush();
+      const auto n =
+          std::min(bytes.size(), std::size_t(buffer_.end - buffer_.pos));
+      buffer_.pos = std::copy_n(bytes.begin(), n, buffer_.pos);
+      bytes = bytes.subspan(n);
+    }
+  }
+
+  void flush() {
+    if (buffer_.pos != begin_)
+      write({begin_, buffer_.pos});
+    buffer_.pos = begin_;
+  }
+
+  buffer_t &buffer() { return buffer_; }
+
+protected:
+  output_t() = default;
+
+  /**
+   * Derived classes provide the storage once their members are constructed.
+   */
+  void storage(std::span<std::byte> storage) {
+    begin_ = storage.data();
+    buffer_ = {begin_, begin_ + storage.size()};
+  }
+
+private:
+  virtual void write(std::span<const std::byte>) = 0;
+
+  buffer_t buffer_{};
+  std::byte *begin_{};
+};
+
+/**
+ * Adapts a putc_t callback; it's called for each byte on flush.
+ */
+class putc_output_t : public output_t {
+public:
+  explicit putc_output_t(putc_t putc) : putc_(std::move(putc)) {
+    storage(storage_);
+  }
+
+private:
+  void write(std::span<const std::byte>) override;
+
+  putc_t putc_;
+  std::array<std::byte, 1 << 12> storage_;
+};
+
+/**
+ * Writes straight to a file descriptor, e.g. stdout, with write(2).
+ */
+class fd_output_t : public output_t {
+public:
+  explicit fd_output_t(int fd) : fd_(fd) { storage({storage_.get(), size}); }
+
+  ~fd_output_t() override;
+
+private:
+  static constexpr std::size_t size = 1 << 16;
+
+  void write(std::span<const std::byte>) override;
+
+  int fd_;
+  std::unique_ptr<std::byte[]> storage_ = std::make_unique<std::byte[]>(size);
+};
+
+/**
+ * Collects everything written into a string, e.g. to capture a program's
+ * output in memory.
+ */
+class string_output_t : public output_t {
+public:
+  string_output_t() { storage(storage_); }
+
+  /**
+   * What's been flushed so far.
+   */
+  std::string &str() { return string_; }
+
+private:
+  void write(std::span<const std::byte>) override;
+
+  std::string string_;
+  std::array<std::byte, 1 << 12> storage_;
+};
+
+/**
+ * An input buffer that machines (and their generated code) read from
+ * directly; underflow() refills it in bulk with read() once it's empty.
+ */
+class input_t {
+public:
+  /**
+   * What a read at end of input stores in the cell.
+   */
+  enum class eof_t { zero, minus_one, unchanged };
+
+  /**
+   * The part of the state that generated code updates in place: the next
+   * unread byte and the end of the buffered input.
+   */
+  struct buffer_t {
+    const std::byte *pos;
+    const std::byte *end;
+  };
+
+  input_t(const input_t &) = delete;
+  input_t &operator=(const input_t &) = delete;
+
+  virtual ~input_t() = default;
+
+  /**
+   * The next input byte, or the eof policy applied to current.
+   */
+  std::byte get(std::byte current) {
+    if (buffer_.pos == buffer_.end)
+      return underflow(current);
+    return *buffer_.pos++;
+  }
+
+  /**
+   * Refill the empty buffer and return its first byte; flushes the tied
+   * output first since a read may block.
+   */
+  std::byte underflow(std::byte current);
+
+  /**
+   * get and underflow for a cell of type Cell: the byte read is zero
+   * extended, and minus_one at end of input sets every bit.
+   */
+  template <std::unsigned_integral Cell> Cell get(Cell current) {
+    if (buffer_.pos == buffer_.end)
+      return underflow(current);
+    return std::to_integer<Cell>(*buffer_.pos++);
+  }
+
+  template <std::unsigned_integral Cell> Cell underflow(Cell current) {
+    if (refill())
+      return std::to_integer<Cell>(*buffer_.pos++);
+    switch (eof_) {
+    case eof_t::zero:
+      return 0;
+    case eof_t::minus_one:
+      return Cell(-1);
+    case eof_t::unchanged:
+      break;
+    }
+    return current;
+  }
+
+  /**
+   * Output to flush before each refill, e.g. so a prompt appears before
+   * reading a reply; may be null.
+   */
+  void tie(output_t *output) { tie_ = output; }
+
+  buffer_t &buffer() { return buffer_; }
+
+  /**
+   * The number of bytes taken from the buffer so far.
+   */
+  std::uint64_t consumed() const {
+    return read_ - std::uint64_t(buffer_.end - buffer_.pos);
+  }
+
+  /**
+   * Discard the next n bytes, or all that's left, e.g. what an earlier run
+   * had already consumed.
+   */
+  void skip(std::uint64_t n);
+
+protected:
+  explicit input_t(eof_t eof) : eof_(eof) {}
+
+  /**
+   * Derived classes provide the storage once their members are constructed.
+   */
+  void storage(std::span<std::byte> storage) {
+    storage_ = storage;
+    buffer_ = {storage.data(), storage.data()};
+  }
+
+  /**
+   * Or provide the whole input up front.
+   */
+  void contents(std::span<const std::byte> contents) {
+    buffer_ = {contents.data(), contents.data() + contents.size()};
+    read_ = contents.size();
+  }
+
+private:
+  /**
+   * Read into the storage; returns the number of bytes read, 0 at end of
+   * input.
+   */
+  virtual std::size_t read(std::span<std::byte>) = 0;
+
+  /**
+   * Flush the tied output then refill the empty buffer; false at end of
+   * input.
+   */
+  bool refill();
+
+  buffer_t buffer_{};
+  std::span<std::byte> storage_{};
+  std::uint64_t read_ = 0;
+  eof_t eof_;
+  output_t *tie_{};
+};
+
+/**
+ * Adapts a getc_t callback, calling it once per refill; never ends.
+ */
+class getc_input_t : public input_t {
+public:
+  explicit getc_input_t(getc_t getc)
+      : input_t(eof_t::unchanged), getc_(std::move(getc)) {
+    storage(storage_);
+  }
+
+private:
+  std::size_t read(std::span<std::byte>) override;
+
+  getc_t getc_;
+  std::array<std::byte, 1> storage_;
+};
+
+/**
+ * Reads from a file descriptor, e.g. stdin, in large chunks with read(2).
+ */
+class fd_input_t : public input_t {
+public:
+  fd_input_t(int fd, eof_t eof) : input_t(eof), fd_(fd) {
+    storage({storage_.get(), size});
+  }
+
+private:
+  static constexpr std::size_t size = 1 << 16;
+
+  std::size_t read(std::span<std::byte>) override;
+
+  int fd_;
+  std::unique_ptr<std::byte[]> storage_ = std::make_unique<std::byte[]>(size);
+};
+
+/**
+ * Reads from memory in place; the memory must outlive the input.
+ */
+class memory_input_t : public input_t {
+public:
+  memory_input_t(std::span<const std::byte> memory, eof_t eof)
+      : input_t(eof) {
+    contents(memory);
+  }
+
+private:
+  std::size_t read(std::span<std::byte>) override { return 0; }
+};
+
+} // namespace brainfk
+
+#endif // BRAINFK_IO_HPP
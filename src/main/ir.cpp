@@ -0,0 +1,860 @@
+#include "ir.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <format>
+#include <iterator>
+#include <optional>
+#include <span>
+#include <stack>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace {
+
+using brainfk::ir::node_t;
+using brainfk::ir::op_t;
+using brainfk::ir::program_t;
+
+/**
+ * Fold pointer moves into the offsets of the following operations so that a
+ * move is only materialized at loop boundaries, before a scan and at the end
+ * of the program. Adds and sets to a cell merge into the last add or set to
+ * that cell provided nothing in between reads or writes it.
+ */
+program_t fold(const program_t &program) {
+  program_t result;
+  result.reserve(program.size());
+
+  std::int32_t pending = 0;
+  std::uint32_t pending_origin = 0;
+  // offset -> index in result of the last mergeable add or set to that cell
+  std::unordered_map<std::int32_t, std::size_t> last;
+
+  const auto flush = [&]() {
+    if (pending)
+      result.push_back({op_t::move, 0, pending, 0, pending_origin});
+    pending = 0;
+    last.clear();
+  };
+
+  for (auto node : program) {
+    node.offset += pending;
+    switch (node.op) {
+    case op_t::move:
+      if (!pending)
+        pending_origin = node.origin;
+      pending += node.value;
+      break;
+    case op_t::add:
+    case op_t::set:
+      if (auto i = last.find(node.offset); i != last.end()) {
+        auto &prev = result[i->second];
+        if (node.op == op_t::set)
+          prev = node;
+        else
+          prev.value += node.value;
+      } else {
+        last.emplace(node.offset, result.size());
+        result.push_back(node);
+      }
+      break;
+    case op_t::mul:
+      node.source += pending;
+      last.erase(node.source);
+      last.erase(node.offset);
+      result.push_back(node);
+      break;
+    case op_t::put:
+    case op_t::get:
+      last.erase(node.offset);
+      result.push_back(node);
+      break;
+    case op_t::write:
+      // it touches no cell for the offset to be of
+      node.offset = 0;
+      result.push_back(node);
+      break;
+    case op_t::scan:
+    case op_t::open:
+    case op_t::close:
+      node.offset = 0;
+      flush();
+      result.push_back(node);
+      break;
+    }
+  }
+  flush();
+
+  std::erase_if(result, [](const node_t &node) {
+    return node.op == op_t::add && node.value == 0;
+  });
+
+  return result;
+}
+
+/**
+ * Try to replace a loop body with straight line code; on success the
+ * replacement, from origin, is appended to result.
+ */
+bool replace_loop(std::span<const node_t> body, std::uint32_t origin,
+                  program_t &result) {
+  // [>] [<<] etc
+  if (body.size() == 1 && body[0].op == op_t::move) {
+    result.push_back({op_t::scan, 0, body[0].value, 0, origin});
+    return true;
+  }
+
+  // [-] [->+>++<<] etc: only adds, no net pointer movement and the loop cell
+  // changes by one each iteration so the iteration count is known up front;
+  // the multiplies test the loop cell, so a loop that doesn't run touches
+  // none of its targets
+  if (!std::ranges::all_of(body,
+                           [](auto &node) { return node.op == op_t::add; }))
+    return false;
+
+  const auto counter = std::ranges::find(body, 0, &node_t::offset);
+  if (counter == body.end() || (counter->value != 1 && counter->value != -1))
+    return false;
+
+  for (const auto &node : body) {
+    if (&node != &*counter)
+      result.push_back(
+          {op_t::mul, node.offset, -counter->value * node.value, 0, origin});
+  }
+  result.push_back({op_t::set, 0, 0, 0, origin});
+  return true;
+}
+
+/**
+ * Replace innermost loops that match an idiom.
+ */
+program_t replace_loops(const program_t &program) {
+  program_t result;
+  result.reserve(program.size());
+
+  std::stack<std::size_t> opens;
+  for (const auto &node : program) {
+    if (node.op == op_t::open) {
+      opens.push(result.size());
+    } else if (node.op == op_t::close) {
+      const auto open = opens.top();
+      opens.pop();
+      const auto body = std::span(result).subspan(open + 1);
+      program_t replacement;
+      if (replace_loop(body, result[open].origin, replacement)) {
+        result.resize(open);
+        std::ranges::copy(replacement, std::back_inserter(result));
+        continue;
+      }
+    }
+    result.push_back(node);
+  }
+
+  return result;
+}
+
+/**
+ * What's known of a cell at some point in a program: nothing, that it isn't
+ * zero, or its value modulo 2^32. Backends truncate to 8, 16 or 32 bits, so
+ * a value is only zero if it's zero at every width, and only non-zero if its
+ * low byte is.
+ */
+struct fact_t {
+  enum class kind_t : std::uint8_t { unknown, nonzero, value };
+
+  kind_t kind = kind_t::unknown;
+  std::uint32_t value = 0;
+
+  static constexpr fact_t known(std::uint32_t value) {
+    return {kind_t::value, value};
+  }
+
+  bool zero() const { return kind == kind_t::value && !value; }
+  bool nonzero() const {
+    return kind == kind_t::nonzero || (kind == kind_t::value && value & 0xff);
+  }
+
+  bool operator==(const fact_t &) const = default;
+};
+
+constexpr fact_t unknown{};
+constexpr fact_t nonzero{fact_t::kind_t::nonzero};
+
+/**
+ * What both a and b say.
+ */
+fact_t meet(const fact_t &a, const fact_t &b) {
+  return a == b                        ? a
+         : a.nonzero() && b.nonzero() ? nonzero
+                                       : unknown;
+}
+
+/**
+ * The facts about the tape at some point. They're keyed by where the cell
+ * was relative to the pointer when they were last forgotten, so a move only
+ * shifts base. Cells without a fact are zero until the pointer moves an
+ * unknown distance, after which they're unknown.
+ */
+class facts_t {
+public:
+  fact_t at(std::int32_t offset) const {
+    const auto i = cells_.find(base_ + offset);
+    return i != cells_.end() ? i->second : zeros_ ? fact_t::known(0) : unknown;
+  }
+
+  /**
+   * Whether the program has written the cell, so what's known of it doesn't
+   * rest on the tape starting zeroed.
+   */
+  bool written(std::int32_t offset) const {
+    return cells_.contains(base_ + offset);
+  }
+
+  void set(std::int32_t offset, fact_t fact) {
+    cells_.insert_or_assign(base_ + offset, fact);
+  }
+
+  /**
+   * Back to what the tape started with.
+   */
+  void reset(std::int32_t offset) { cells_.erase(base_ + offset); }
+
+  void move(std::int32_t offset) { base_ += offset; }
+
+  /**
+   * After the pointer moves an unknown distance.
+   */
+  void forget() {
+    base_ = 0;
+    zeros_ = false;
+    cells_.clear();
+  }
+
+private:
+  std::int64_t base_ = 0;
+  bool zeros_ = true;
+  std::unordered_map<std::int64_t, fact_t> cells_;
+};
+
+/**
+ * The offsets, from the pointer at its start, of the cells a loop body may
+ * write; nothing if the body moves the pointer a net or unknown distance,
+ * so may write anywhere.
+ */
+std::optional<std::vector<std::int32_t>>
+writes(std::span<const node_t> body) {
+  std::vector<std::int32_t> result;
+  std::int32_t shift = 0;
+  std::stack<std::int32_t> opens;
+  for (const auto &node : body) {
+    switch (node.op) {
+    case op_t::add:
+    case op_t::set:
+    case op_t::mul:
+    case op_t::get:
+      result.push_back(shift + node.offset);
+      break;
+    case op_t::move:
+      shift += node.value;
+      break;
+    case op_t::scan:
+      return std::nullopt;
+    case op_t::open:
+      opens.push(shift);
+      break;
+    case op_t::close:
+      if (opens.top() != shift)
+        return std::nullopt;
+      opens.pop();
+      break;
+    case op_t::put:
+    case op_t::write:
+      break;
+    }
+  }
+  if (shift)
+    return std::nullopt;
+  return result;
+}
+
+/**
+ * Track what's known of each cell through the program, starting from a tape
+ * of zeros, and use it to:
+ *   - drop loops and scans that start on a zero cell, e.g. a leading comment
+ *     loop or a loop straight after another on the same cell;
+ *   - drop sets of a cell the program has written to the value it already
+ *     has, and multiplies by a zero cell; a clear of a cell only the zeroed
+ *     tape says is zero is kept, so a program that clears its cells first
+ *     still runs on a reused tape;
+ *   - mark loops entered on a non-zero cell, whose first test can be skipped,
+ *     and loops that end on a zero cell, which never go round again; a loop
+ *     that's both is replaced by its body.
+ * A loop body starts from what's true on every iteration: what was known on
+ * entry, less the cells the body writes, or nothing if it isn't balanced.
+ */
+program_t propagate(const program_t &program) {
+  program_t result;
+  result.reserve(program.size());
+
+  // the close matching each open
+  std::vector<std::size_t> closes(program.size());
+  {
+    std::stack<std::size_t> opens;
+    for (std::size_t i = 0; i < program.size(); ++i) {
+      if (program[i].op == op_t::open) {
+        opens.push(i);
+      } else if (program[i].op == op_t::close) {
+        closes[opens.top()] = i;
+        opens.pop();
+      }
+    }
+  }
+
+  struct loop_t {
+    // the index in result of the open
+    std::size_t open;
+    // the facts on entry about the cells the body writes, and whether the
+    // program had written them; empty if it isn't balanced
+    std::optional<std::vector<std::tuple<std::int32_t, fact_t, bool>>> entry;
+  };
+  std::stack<loop_t> loops;
+  // the opens of loops replaced by their bodies
+  std::vector<std::size_t> unwrapped;
+
+  facts_t facts;
+  for (std::size_t i = 0; i < program.size(); ++i) {
+    auto node = program[i];
+    switch (node.op) {
+    case op_t::add: {
+      const auto fact = facts.at(node.offset);
+      facts.set(node.offset, fact.kind == fact_t::kind_t::value
+                                 ? fact_t::known(fact.value +
+                                                 std::uint32_t(node.value))
+                                 : unknown);
+      break;
+    }
+    case op_t::move:
+      facts.move(node.value);
+      break;
+    case op_t::set:
+      if (facts.written(node.offset) &&
+          facts.at(node.offset) == fact_t::known(std::uint32_t(node.value)))
+        continue;
+      facts.set(node.offset, fact_t::known(std::uint32_t(node.value)));
+      break;
+    case op_t::mul: {
+      const auto source = facts.at(node.source);
+      if (source.zero())
+        continue;
+      const auto target = facts.at(node.offset);
+      facts.set(node.offset,
+                source.kind == fact_t::kind_t::value &&
+                        target.kind == fact_t::kind_t::value
+                    ? fact_t::known(target.value +
+                                    source.value * std::uint32_t(node.value))
+                    : unknown);
+      break;
+    }
+    case op_t::scan:
+      if (facts.at(0).zero())
+        continue;
+      facts.forget();
+      facts.set(0, fact_t::known(0));
+      break;
+    case op_t::put:
+    case op_t::write:
+      break;
+    case op_t::get:
+      facts.set(node.offset, unknown);
+      break;
+    case op_t::open: {
+      if (facts.at(0).zero()) {
+        i = closes[i];
+        continue;
+      }
+      const auto entered = facts.at(0).nonzero();
+      node.value = entered;
+
+      loop_t loop{result.size(), std::nullopt};
+      const auto body = std::span(program).subspan(i + 1, closes[i] - i - 1);
+      if (const auto offsets = writes(body)) {
+        loop.entry.emplace();
+        for (const auto offset : *offsets) {
+          if (!entered)
+            loop.entry->emplace_back(offset, facts.at(offset),
+                                     facts.written(offset));
+          facts.set(offset, unknown);
+        }
+      } else {
+        facts.forget();
+      }
+      if (!facts.at(0).nonzero())
+        facts.set(0, nonzero);
+      loops.push(std::move(loop));
+      break;
+    }
+    case op_t::close: {
+      const auto loop = std::move(loops.top());
+      loops.pop();
+      const auto entered = bool(result[loop.open].value);
+      const auto exits = facts.at(0).zero();
+      if (entered && exits) {
+        unwrapped.push_back(loop.open);
+        continue;
+      }
+      node.value = exits;
+
+      // a loop that may not have been entered leaves what was known on
+      // entry, or nothing if the pointer may have moved
+      if (!entered && loop.entry) {
+        for (const auto &[offset, fact, written] : *loop.entry) {
+          // zero only because the tape started zeroed, if the loop didn't
+          // run
+          const auto met = meet(fact, facts.at(offset));
+          if (!written && met == fact)
+            facts.reset(offset);
+          else
+            facts.set(offset, met);
+        }
+      } else if (!entered) {
+        facts.forget();
+      }
+      facts.set(0, fact_t::known(0));
+      break;
+    }
+    }
+    result.push_back(node);
+  }
+
+  if (unwrapped.empty())
+    return result;
+
+  std::ranges::sort(unwrapped);
+  program_t kept;
+  kept.reserve(result.size());
+  for (std::size_t i = 0, j = 0; i < result.size(); ++i) {
+    if (j < unwrapped.size() && unwrapped[j] == i)
+      ++j;
+    else
+      kept.push_back(result[i]);
+  }
+  return kept;
+}
+
+/**
+ * The tape evaluate runs on: the cells every tape has, see
+ * tape_t::default_size, grown as they're written, with a journal of what
+ * the cells written since the last commit held then so the writes can be
+ * undone.
+ */
+class image_t {
+public:
+  static constexpr std::int64_t size = 30'000;
+
+  static bool contains(std::int64_t index) {
+    return index >= 0 && index < size;
+  }
+
+  std::uint32_t load(std::int64_t index) const {
+    return std::size_t(index) < cells_.size() ? cells_[std::size_t(index)]
+                                              : 0;
+  }
+
+  void store(std::int64_t index, std::uint32_t value) {
+    const auto i = std::size_t(index);
+    if (i >= cells_.size()) {
+      const auto grown =
+          std::min(std::max(cells_.size() * 2, i + 1), std::size_t(size));
+      cells_.resize(grown);
+      epochs_.resize(grown);
+      written_.resize(grown);
+    }
+    // a cell's first write since the commit is enough to undo them all
+    if (epochs_[i] != epoch_) {
+      epochs_[i] = epoch_;
+      journal_.emplace_back(i, cells_[i]);
+    }
+    cells_[i] = value;
+  }
+
+  void commit() {
+    for (const auto &[i, value] : journal_)
+      written_[i] = true;
+    journal_.clear();
+    ++epoch_;
+  }
+
+  void rollback() {
+    for (const auto &[i, value] : journal_)
+      cells_[i] = value;
+    journal_.clear();
+    ++epoch_;
+  }
+
+  const std::vector<std::uint32_t> &cells() const { return cells_; }
+
+  /**
+   * Whether a committed write reached the cell, whatever it left there.
+   */
+  bool written(std::size_t index) const {
+    return index < written_.size() && written_[index];
+  }
+
+private:
+  std::vector<std::uint32_t> cells_;
+  // the commit each cell was last journaled in
+  std::vector<std::uint64_t> epochs_;
+  std::vector<bool> written_;
+  std::uint64_t epoch_ = 1;
+  std::vector<std::pair<std::size_t, std::uint32_t>> journal_;
+};
+
+/**
+ * Whether a cell holding value, modulo 2^32, is zero at every width, or
+ * non-zero at every width; nothing if that depends on the width.
+ */
+std::optional<bool> zero(std::uint32_t value) {
+  if (!value)
+    return true;
+  if (value & 0xff)
+    return false;
+  return std::nullopt;
+}
+
+/**
+ * Whether c is one of the eight brainfk characters.
+ */
+constexpr bool command(char c) {
+  switch (c) {
+  case '+':
+  case '-':
+  case '>':
+  case '<':
+  case '.':
+  case ',':
+  case '[':
+  case ']':
+    return true;
+  default:
+    return false;
+  }
+}
+
+#if defined(__x86_64__)
+
+/**
+ * The mask of the brainfk characters among the 16 bytes at p.
+ */
+std::uint32_t commands(const char *p) {
+  const auto v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+  auto hits = _mm_setzero_si128();
+  for (const char c : {'+', '-', '>', '<', '.', ',', '[', ']'})
+    hits = _mm_or_si128(hits, _mm_cmpeq_epi8(v, _mm_set1_epi8(c)));
+  return std::uint32_t(_mm_movemask_epi8(hits));
+}
+
+/**
+ * The mask of the bytes equal to c among the 16 at p.
+ */
+std::uint32_t matches(const char *p, char c) {
+  const auto v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+  return std::uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(c))));
+}
+
+#endif
+
+/**
+ * The number of brainfk characters in source, a bound on the nodes it
+ * parses to.
+ */
+std::size_t count(std::string_view source) {
+  std::size_t result = 0;
+  std::size_t i = 0;
+#if defined(__x86_64__)
+  for (; i + 16 <= source.size(); i += 16)
+    result += std::size_t(std::popcount(commands(source.data() + i)));
+#endif
+  for (; i < source.size(); ++i)
+    result += command(source[i]);
+  return result;
+}
+
+/**
+ * The index of the first brainfk character at or after i, skipping comments
+ * 16 bytes at a time where possible.
+ */
+std::size_t skip(std::string_view source, std::size_t i) {
+  // dense code needn't go through the vector path
+  if (i < source.size() && command(source[i]))
+    return i;
+#if defined(__x86_64__)
+  for (; i + 16 <= source.size(); i += 16) {
+    if (const auto mask = commands(source.data() + i))
+      return i + std::size_t(std::countr_zero(mask));
+  }
+#endif
+  while (i < source.size() && !command(source[i]))
+    ++i;
+  return i;
+}
+
+/**
+ * The length of the run of source[i] starting at i.
+ */
+std::size_t repeats(std::string_view source, std::size_t i) {
+  const auto c = source[i];
+  if (i + 1 == source.size() || source[i + 1] != c)
+    return 1;
+  const auto begin = i;
+#if defined(__x86_64__)
+  for (; i + 16 <= source.size(); i += 16) {
+    const auto run = std::countr_one(matches(source.data() + i, c));
+    if (run < 16)
+      return i + std::size_t(run) - begin;
+  }
+#endif
+  while (i < source.size() && source[i] == c)
+    ++i;
+  return i - begin;
+}
+
+} // namespace
+
+brainfk::ir::program_t brainfk::ir::parse(std::string_view source) {
+  // counting first is cheaper than growing result
+  program_t result;
+  result.reserve(count(source));
+
+  // index into the filtered program of each open bracket, for diagnostics
+  std::vector<std::size_t> opens;
+  std::size_t position = 0;
+
+  const auto run = [&](op_t op, std::int32_t value, std::size_t origin) {
+    if (!result.empty() && result.back().op == op)
+      result.back().value += value;
+    else
+      result.push_back({op, 0, value, 0, std::uint32_t(origin)});
+  };
+
+  for (auto i = skip(source, 0); i < source.size(); i = skip(source, i)) {
+    const auto c = source[i];
+    switch (c) {
+    case '+':
+    case '-':
+    case '>':
+    case '<': {
+      const auto length = repeats(source, i);
+      const auto value = std::int32_t(length);
+      if (c == '+' || c == '-')
+        run(op_t::add, c == '+' ? value : -value, i);
+      else
+        run(op_t::move, c == '>' ? value : -value, i);
+      i += length;
+      position += length;
+      continue;
+    }
+    case '.':
+      result.push_back({op_t::put, 0, 0, 0, std::uint32_t(i)});
+      break;
+    case ',':
+      result.push_back({op_t::get, 0, 0, 0, std::uint32_t(i)});
+      break;
+    case '[':
+      opens.push_back(position);
+      result.push_back({op_t::open, 0, 0, 0, std::uint32_t(i)});
+      break;
+    case ']':
+      if (opens.empty())
+        throw std::runtime_error{std::format(
+            "malformed program: unmatched ']' at {}", position)};
+      opens.pop_back();
+      result.push_back({op_t::close, 0, 0, 0, std::uint32_t(i)});
+      break;
+    }
+    ++i;
+    ++position;
+  }
+
+  if (!opens.empty())
+    throw std::runtime_error{
+        std::format("malformed program: unmatched '[' at {}", opens.back())};
+
+  return result;
+}
+
+void brainfk::ir::strip_comments(std::string_view source, std::string &text) {
+  for (auto i = skip(source, 0); i < source.size(); i = skip(source, i)) {
+    const auto begin = i;
+    while (i < source.size() && command(source[i]))
+      ++i;
+    text.append(source.substr(begin, i - begin));
+  }
+}
+
+brainfk::ir::program_t brainfk::ir::optimize(program_t program) {
+  program = fold(program);
+  program = replace_loops(program);
+  program = propagate(program);
+  program = fold(program);
+  return program;
+}
+
+brainfk::ir::program_t brainfk::ir::evaluate(program_t program,
+                                             std::uint64_t steps) {
+  // a larger output costs more to compile than to compute
+  constexpr std::size_t max_output = 1 << 16;
+
+  // the matching bracket of each open and close
+  std::vector<std::size_t> jumps(program.size());
+  {
+    std::stack<std::size_t> opens;
+    for (std::size_t i = 0; i < program.size(); ++i) {
+      if (program[i].op == op_t::open) {
+        opens.push(i);
+      } else if (program[i].op == op_t::close) {
+        jumps[i] = opens.top();
+        jumps[opens.top()] = i;
+        opens.pop();
+      }
+    }
+  }
+
+  image_t image;
+  std::int64_t pointer = 0;
+  std::string output;
+
+  // the state after the top level nodes before done, all of which finished
+  std::size_t done = 0;
+  std::int64_t done_pointer = 0;
+  std::size_t done_output = 0;
+
+  const auto run = [&]() {
+    std::size_t depth = 0;
+    for (std::size_t i = 0; i < program.size();) {
+      if (!depth) {
+        image.commit();
+        done = i;
+        done_pointer = pointer;
+        done_output = output.size();
+      }
+      if (!steps--)
+        return;
+
+      const auto &node = program[i];
+      const auto at = pointer + node.offset;
+      if (node.op != op_t::move && node.op != op_t::write &&
+          node.op != op_t::mul && !image_t::contains(at))
+        return;
+      switch (node.op) {
+      case op_t::add:
+        image.store(at, image.load(at) + std::uint32_t(node.value));
+        break;
+      case op_t::move:
+        pointer += node.value;
+        break;
+      case op_t::set:
+        image.store(at, std::uint32_t(node.value));
+        break;
+      case op_t::mul: {
+        const auto source = pointer + node.source;
+        if (!image_t::contains(source))
+          return;
+        // zero at every width, so the target isn't touched
+        if (!image.load(source))
+          break;
+        if (!image_t::contains(at))
+          return;
+        image.store(at, image.load(at) + image.load(source) *
+                                             std::uint32_t(node.value));
+        break;
+      }
+      case op_t::scan:
+        for (;;) {
+          const auto stop = zero(image.load(pointer));
+          if (!stop)
+            return;
+          if (*stop)
+            break;
+          pointer += node.value;
+          if (!image_t::contains(pointer) || !steps--)
+            return;
+        }
+        break;
+      case op_t::put:
+        if (output.size() == max_output)
+          return;
+        output.push_back(char(image.load(at)));
+        break;
+      case op_t::write:
+        if (output.size() + std::size_t(node.source) > max_output)
+          return;
+        for (std::size_t j = 0; j < std::size_t(node.source); ++j)
+          output.push_back(char(written(node.value, j)));
+        break;
+      case op_t::get:
+        return;
+      case op_t::open:
+      case op_t::close: {
+        const auto stop = zero(image.load(at));
+        if (!stop)
+          return;
+        // past a loop on a zero cell, round again on a non-zero one
+        if (*stop == (node.op == op_t::open)) {
+          i = jumps[i] + 1;
+          continue;
+        }
+        if (node.op == op_t::open)
+          ++depth;
+        else
+          --depth;
+        break;
+      }
+      }
+      ++i;
+    }
+    image.commit();
+    done = program.size();
+    done_pointer = pointer;
+    done_output = output.size();
+  };
+  run();
+  image.rollback();
+  output.resize(done_output);
+
+  if (!done)
+    return program;
+
+  // the output a few bytes a write, then the cells as they were left;
+  // those left zero too, like the clears propagate keeps
+  program_t result;
+  for (std::size_t i = 0; i < output.size(); i += max_written) {
+    const auto bytes = std::string_view(output).substr(i, max_written);
+    std::uint32_t value = 0;
+    for (auto j = bytes.size(); j-- > 0;)
+      value = value << 8 | std::uint8_t(bytes[j]);
+    result.push_back(
+        {op_t::write, 0, std::int32_t(value), std::int32_t(bytes.size())});
+  }
+  const auto &cells = image.cells();
+  for (std::size_t i = 0; i < cells.size(); ++i) {
+    if (cells[i] || image.written(i))
+      result.push_back(
+          {op_t::set, std::int32_t(i), std::int32_t(cells[i])});
+  }
+  if (done_pointer)
+    result.push_back({op_t::move, 0, std::int32_t(done_pointer)});
+  std::copy(program.begin() + std::ptrdiff_t(done), program.end(),
+            std::back_inserter(result));
+
+  // the sets rebuild the tape from zero, so what's known still holds
+  return fold(propagate(result));
+}
@@ -0,0 +1,109 @@
+#ifndef BRAINFK_IR_HPP
+#define BRAINFK_IR_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace brainfk::ir {
+
+/**
+ * Intermediate representation operations. Offsets are relative to the
+ * current pointer. Values are exact sums; backends truncate to the cell width.
+ */
+enum class op_t : std::uint8_t {
+  add,   // cell[offset] += value
+  move,  // pointer += value
+  set,   // cell[offset] = value
+  mul,   // if (cell[source]) cell[offset] += cell[source] * value
+  scan,  // while (cell[0]) pointer += value
+  put,   // output cell[offset]
+  get,   // input into cell[offset]
+  open,  // while (cell[0]) {; value 1 if cell[0] is known non-zero on entry
+  close, // }; value 1 if cell[0] is known zero here, so the loop never repeats
+  write, // output source bytes packed in value, for constant output
+};
+
+/**
+ * The most bytes a write outputs.
+ */
+inline constexpr std::size_t max_written = sizeof(std::int32_t);
+
+/**
+ * The ith byte packed in a write's value, the first the lowest.
+ */
+constexpr std::byte written(std::int32_t value, std::size_t i) {
+  return std::byte(std::uint32_t(value) >> (8 * i));
+}
+
+struct node_t {
+  op_t op;
+  std::int32_t offset = 0;
+  std::int32_t value = 0;
+  std::int32_t source = 0;
+  /**
+   * Where in the source text the node came from, e.g. for a profile: the
+   * first character of a run, or the '[' of a replaced loop. Nodes that do
+   * the same are equal wherever they came from.
+   */
+  std::uint32_t origin = 0;
+
+  bool operator==(const node_t &other) const {
+    return op == other.op && offset == other.offset && value == other.value &&
+           source == other.source;
+  }
+};
+
+/**
+ * A program is a flat sequence of nodes with balanced open/close pairs.
+ */
+using program_t = std::vector<node_t>;
+
+/**
+ * Translate source to nodes one to one, folding runs of +-<>; non brainfk
+ * characters are ignored. Throws std::runtime_error on unbalanced brackets.
+ */
+program_t parse(std::string_view source);
+
+/**
+ * Append source's brainfk characters to text, dropping the comments that
+ * parsing and cache keys ignore anyway, e.g. as a program arrives in chunks.
+ */
+void strip_comments(std::string_view source, std::string &text);
+
+/**
+ * Run the optimization pipeline:
+ *   - fold pointer moves into the offsets of the operations between loop
+ *     boundaries and merge adds/sets to the same cell;
+ *   - replace clear, multiply/copy and scan loops with set, mul and scan;
+ *   - track what's known of each cell from the zero tape at program start
+ *     to drop loops and scans on zero cells and redundant sets, mark loop
+ *     tests whose outcome is known and unwrap loops that run exactly once.
+ */
+program_t optimize(program_t program);
+
+/**
+ * Partially evaluate program at compile time. Its top level nodes are run
+ * from the zero tape, up to steps nodes, until one needs input. Those that
+ * finished are replaced by writes of their output, then sets of the cells
+ * they wrote and a move to where they left the pointer. A program that
+ * needs no input and finishes in time becomes just its output.
+ *
+ * Cells are evaluated modulo 2^32. A loop test that would depend on the
+ * cell width also stops evaluation, as do cells past the 30,000 every tape
+ * has and more than 64KiB of output, so the result suits any tape.
+ */
+program_t evaluate(program_t program, std::uint64_t steps = 1 << 20);
+
+/**
+ * parse then optimize.
+ */
+inline program_t compile(std::string_view source) {
+  return optimize(parse(source));
+}
+
+} // namespace brainfk::ir
+
+#endif // BRAINFK_IR_HPP
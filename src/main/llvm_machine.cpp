@@ -1,17 +1,40 @@
 #include "llvm_machine.hpp"
+#include "cache.hpp"
+#include "ir.hpp"
+#include "runtime.hpp"
+#include "tape.hpp"
 
 #include <llvm-c/Analysis.h>
 #include <llvm-c/Core.h>
-#include <llvm-c/ExecutionEngine.h>
+#include <llvm-c/Error.h>
+#include <llvm-c/LLJIT.h>
+#include <llvm-c/Orc.h>
 #include <llvm-c/Target.h>
+#include <llvm-c/TargetMachine.h>
+#include <llvm-c/Transforms/PassBuilder.h>
 
+#include <algorithm>
 #include <array>
-#include <bits/codecvt.h>
+#include <atomic>
 #include <cassert>
-#include <iostream>
+#include <condition_variable>
+#include <cstring>
+#include <exception>
+#include <format>
+#include <iterator>
+#include <memory>
+#include <mutex>
 #include <optional>
+#include <span>
 #include <stack>
+#include <stdexcept>
+#include <string>
 #include <string_view>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 namespace {
 
@@ -28,6 +51,15 @@ public:
   [[nodiscard]] const T &get() const { return *ref_; }
   [[nodiscard]] T &get() { return *ref_; }
 
+  /**
+   * Give up ownership, e.g. of a module handed to the JIT.
+   */
+  T release() {
+    auto result = *ref_;
+    ref_.reset();
+    return result;
+  }
+
   ~llvm_ptr() {
     if (ref_) {
       assert(dtor_ != nullptr);
@@ -40,214 +72,970 @@ private:
   void (*dtor_)(T);
 };
 
-struct executable_t : brainfk::executable_t {
-  explicit executable_t(std::string_view program) {
+/**
+ * Throw if err is an error, consuming it.
+ */
+void check(LLVMErrorRef err, std::string_view what) {
+  if (!err)
+    return;
+  const auto message = LLVMGetErrorMessage(err);
+  std::string text{message};
+  LLVMDisposeErrorMessage(message);
+  throw std::runtime_error{std::format("{} failed: {}", what, text)};
+}
+
+/**
+ * Native target registration is process wide, so happens once.
+ */
+void initialize() {
+  static std::once_flag once;
+  std::call_once(once, []() {
     LLVMInitializeNativeTarget();
     LLVMInitializeNativeAsmPrinter();
     LLVMInitializeNativeAsmParser();
-    LLVMInitializeNativeDisassembler();
-    LLVMLinkInMCJIT();
-
-    auto ctx = llvm_ptr(LLVMContextDispose, LLVMContextCreate());
-    auto module = llvm_ptr(LLVMDisposeModule,
-                           LLVMModuleCreateWithNameInContext("", ctx.get()));
-
-    auto void_type = LLVMVoidTypeInContext(ctx.get());
-    auto byte_type = LLVMInt8TypeInContext(ctx.get());
-    auto ptr_type = LLVMPointerType(byte_type, 0);
-    auto void_ptr_type = LLVMPointerType(void_type, 0);
-    auto byte_0 = LLVMConstInt(byte_type, 0, false);
-    auto byte_1 = LLVMConstInt(byte_type, 1, false);
-    auto byte_minus_1 = LLVMConstInt(byte_type, -1, true);
-
-    std::array putc_param_types{byte_type, void_ptr_type};
-    auto putc_type = LLVMFunctionType(void_type, putc_param_types.begin(),
-                                      putc_param_types.size(), 0);
-    auto putc_ptr_type = LLVMPointerType(putc_type, 0);
-
-    std::array getc_param_types{void_ptr_type};
-    auto getc_type = LLVMFunctionType(byte_type, getc_param_types.begin(),
-                                      getc_param_types.size(), 0);
-    auto getc_ptr_type = LLVMPointerType(getc_type, 0);
-
-    std::array main_arg_types{ptr_type, putc_ptr_type, getc_ptr_type,
-                              void_ptr_type};
-    auto main_type = LLVMFunctionType(void_type, main_arg_types.begin(),
-                                      main_arg_types.size(), 0);
-    auto main = LLVMAddFunction(module.get(), "brainfk_main", main_type);
-    LLVMSetLinkage(main, LLVMExternalLinkage);
-
-    auto builder = llvm_ptr(LLVMDisposeBuilder, LLVMCreateBuilder());
-
-    LLVMPositionBuilderAtEnd(
-        builder.get(), LLVMAppendBasicBlockInContext(ctx.get(), main, ""));
-
-    const auto ptr = LLVMBuildAlloca(builder.get(), ptr_type, "");
-    const auto putc_ptr = LLVMBuildAlloca(builder.get(), putc_ptr_type, "");
-    const auto getc_ptr = LLVMBuildAlloca(builder.get(), getc_ptr_type, "");
-    const auto capture_ptr = LLVMBuildAlloca(builder.get(), void_ptr_type, "");
-
-    LLVMBuildStore(builder.get(), LLVMGetParam(main, 0), ptr);
-    LLVMBuildStore(builder.get(), LLVMGetParam(main, 1), putc_ptr);
-    LLVMBuildStore(builder.get(), LLVMGetParam(main, 2), getc_ptr);
-    LLVMBuildStore(builder.get(), LLVMGetParam(main, 3), capture_ptr);
-
-    std::stack<LLVMBasicBlockRef> stack;
-
-    for (auto instruction : program) {
-      switch (instruction) {
-      case '+': {
-        auto ref = LLVMBuildLoad2(builder.get(), ptr_type, ptr, "");
-        auto last = LLVMBuildLoad2(builder.get(), byte_type, ref, "");
-        last = LLVMBuildAdd(builder.get(), last, byte_1, "");
-        last = LLVMBuildStore(builder.get(), last, ref);
-        break;
-      }
-      case '-': {
-        auto ref = LLVMBuildLoad2(builder.get(), ptr_type, ptr, "");
-        auto last = LLVMBuildLoad2(builder.get(), byte_type, ref, "");
-        last = LLVMBuildSub(builder.get(), last, byte_1, "");
-        last = LLVMBuildStore(builder.get(), last, ref);
-        break;
-      }
-      case '>': {
-        auto last = LLVMBuildLoad2(builder.get(), ptr_type, ptr, "");
-        last = LLVMBuildGEP2(builder.get(), byte_type, last, &byte_1, 1, "");
-        last = LLVMBuildStore(builder.get(), last, ptr);
-        break;
-      }
-      case '<': {
-        auto last = LLVMBuildLoad2(builder.get(), ptr_type, ptr, "");
-        last =
-            LLVMBuildGEP2(builder.get(), byte_type, last, &byte_minus_1, 1, "");
-        last = LLVMBuildStore(builder.get(), last, ptr);
-        break;
-      }
-      case '[': {
-        auto head = LLVMAppendBasicBlockInContext(ctx.get(), main, "head");
-        auto body = LLVMAppendBasicBlockInContext(ctx.get(), main, "body");
-        auto tail = LLVMAppendBasicBlockInContext(ctx.get(), main, "tail");
-        auto next = LLVMAppendBasicBlockInContext(ctx.get(), main, "next");
-
-        stack.push(next);
-        stack.push(tail);
-        stack.push(body);
-        stack.push(head);
-
-        LLVMBuildBr(builder.get(), head);
-        LLVMPositionBuilderAtEnd(builder.get(), body);
-        break;
-      }
-      case ']': {
-        if (stack.empty())
-          throw std::runtime_error("unmatched ']'");
-
-        auto head = stack.top();
-        stack.pop();
-        auto body = stack.top();
-        stack.pop();
-        auto tail = stack.top();
-        stack.pop();
-        auto next = stack.top();
-        stack.pop();
-
-        LLVMBuildBr(builder.get(), tail);
-
-        {
-          LLVMPositionBuilderAtEnd(builder.get(), head);
-          auto ref = LLVMBuildLoad2(builder.get(), ptr_type, ptr, "");
-          auto last = LLVMBuildLoad2(builder.get(), byte_type, ref, "");
-          last = LLVMBuildICmp(builder.get(), LLVMIntEQ, last, byte_0, "");
-          last = LLVMBuildCondBr(builder.get(), last, next, body);
-        }
-
-        {
-          LLVMPositionBuilderAtEnd(builder.get(), tail);
-          auto ref = LLVMBuildLoad2(builder.get(), ptr_type, ptr, "");
-          auto last = LLVMBuildLoad2(builder.get(), byte_type, ref, "");
-          last = LLVMBuildICmp(builder.get(), LLVMIntEQ, last, byte_0, "");
-          last = LLVMBuildCondBr(builder.get(), last, next, head);
-        }
-
-        LLVMPositionBuilderAtEnd(builder.get(), next);
-        break;
+  });
+}
+
+/**
+ * The functions generated code calls, by the names it declares them with.
+ */
+const std::array<std::pair<const char *, void *>, 8> runtime_symbols{{
+    {"brainfk_flush", reinterpret_cast<void *>(&brainfk_flush)},
+    {"brainfk_write", reinterpret_cast<void *>(&brainfk_write)},
+    {"brainfk_underflow", reinterpret_cast<void *>(&brainfk_underflow)},
+    {"brainfk_underflow16", reinterpret_cast<void *>(&brainfk_underflow16)},
+    {"brainfk_underflow32", reinterpret_cast<void *>(&brainfk_underflow32)},
+    {"brainfk_scan", reinterpret_cast<void *>(&brainfk_scan)},
+    {"brainfk_scan16", reinterpret_cast<void *>(&brainfk_scan16)},
+    {"brainfk_scan32", reinterpret_cast<void *>(&brainfk_scan32)},
+}};
+
+/**
+ * The type of the functions generated by build: they take the tape pointer,
+ * the output buffer and output_t, and the input buffer and input_t, then
+ * if counted an array of a count per node.
+ */
+LLVMTypeRef entry_type(LLVMContextRef ctx, bool counted = false) {
+  auto ptr_type = LLVMPointerType(LLVMInt8TypeInContext(ctx), 0);
+  auto void_ptr_type = LLVMPointerType(LLVMVoidTypeInContext(ctx), 0);
+  std::array buffer_field_types{ptr_type, ptr_type};
+  auto buffer_ptr_type = LLVMPointerType(
+      LLVMStructTypeInContext(ctx, buffer_field_types.begin(),
+                              buffer_field_types.size(), false),
+      0);
+  std::array arg_types{ptr_type,        buffer_ptr_type, void_ptr_type,
+                       buffer_ptr_type, void_ptr_type,   void_ptr_type};
+  return LLVMFunctionType(ptr_type, arg_types.begin(),
+                          arg_types.size() - !counted, 0);
+}
+
+/**
+ * Generate the function name in module from optimized ir for cells of
+ * cell_bits; it returns the final tape pointer so a caller running part of
+ * a program can carry on. If counted, each node adds one to its count as it
+ * runs; see machine_t::profile.
+ */
+void build(LLVMModuleRef module, const brainfk::ir::program_t &program,
+           const std::string &name, unsigned cell_bits,
+           bool counted = false) {
+  using brainfk::ir::op_t;
+
+  auto ctx = LLVMGetModuleContext(module);
+
+  auto void_type = LLVMVoidTypeInContext(ctx);
+  auto byte_type = LLVMInt8TypeInContext(ctx);
+  auto cell_type = LLVMIntTypeInContext(ctx, cell_bits);
+  auto int32_type = LLVMInt32TypeInContext(ctx);
+  auto int64_type = LLVMInt64TypeInContext(ctx);
+  auto ptr_type = LLVMPointerType(byte_type, 0);
+  auto void_ptr_type = LLVMPointerType(void_type, 0);
+  auto cell_0 = LLVMConstInt(cell_type, 0, false);
+  // the runtime functions for cells wider than a byte have the width on
+  // the end of their name
+  const auto suffix = cell_bits == 8 ? "" : std::format("{}", cell_bits);
+
+  // output_t::buffer_t and input_t::buffer_t
+  std::array buffer_field_types{ptr_type, ptr_type};
+  auto buffer_type =
+      LLVMStructTypeInContext(ctx, buffer_field_types.begin(),
+                              buffer_field_types.size(), false);
+
+  // the runtime functions are external symbols so the object code is
+  // relocatable and can be cached; see runtime_symbols
+  std::array flush_param_types{void_ptr_type};
+  auto flush_type = LLVMFunctionType(void_type, flush_param_types.begin(),
+                                     flush_param_types.size(), 0);
+  auto flush_fn = LLVMAddFunction(module, "brainfk_flush", flush_type);
+
+  std::array write_param_types{void_ptr_type, ptr_type, int64_type};
+  auto write_type = LLVMFunctionType(void_type, write_param_types.begin(),
+                                     write_param_types.size(), 0);
+  auto write_fn = LLVMAddFunction(module, "brainfk_write", write_type);
+
+  std::array underflow_param_types{void_ptr_type, cell_type};
+  auto underflow_type =
+      LLVMFunctionType(cell_type, underflow_param_types.begin(),
+                       underflow_param_types.size(), 0);
+  auto underflow_fn = LLVMAddFunction(
+      module, ("brainfk_underflow" + suffix).c_str(), underflow_type);
+
+  std::array scan_param_types{ptr_type, int32_type};
+  auto scan_type = LLVMFunctionType(ptr_type, scan_param_types.begin(),
+                                    scan_param_types.size(), 0);
+  auto scan_fn =
+      LLVMAddFunction(module, ("brainfk_scan" + suffix).c_str(), scan_type);
+
+  auto main = LLVMAddFunction(module, name.c_str(), entry_type(ctx, counted));
+  LLVMSetLinkage(main, LLVMExternalLinkage);
+
+  auto builder = llvm_ptr(LLVMDisposeBuilder, LLVMCreateBuilder());
+
+  LLVMPositionBuilderAtEnd(
+      builder.get(), LLVMAppendBasicBlockInContext(ctx, main, ""));
+
+  // counts[index] += 1, where the code for the node at index starts
+  const auto count = [&](std::size_t index) {
+    auto i = LLVMConstInt(int64_type, index, false);
+    auto ref = LLVMBuildGEP2(builder.get(), int64_type, LLVMGetParam(main, 5),
+                             &i, 1, "");
+    auto last = LLVMBuildLoad2(builder.get(), int64_type, ref, "");
+    last = LLVMBuildAdd(builder.get(), last,
+                        LLVMConstInt(int64_type, 1, false), "");
+    LLVMBuildStore(builder.get(), last, ref);
+  };
+
+  const auto ptr = LLVMBuildAlloca(builder.get(), ptr_type, "");
+
+  LLVMBuildStore(builder.get(), LLVMGetParam(main, 0), ptr);
+  const auto buffer = LLVMGetParam(main, 1);
+  auto output = LLVMGetParam(main, 2);
+  const auto in_buffer = LLVMGetParam(main, 3);
+  auto input = LLVMGetParam(main, 4);
+
+  // the cell at offset from the current pointer
+  const auto cell = [&](std::int32_t offset) {
+    auto index = LLVMConstInt(int64_type, std::uint64_t(offset), true);
+    auto last = LLVMBuildPointerCast(
+        builder.get(), LLVMBuildLoad2(builder.get(), ptr_type, ptr, ""),
+        LLVMPointerType(cell_type, 0), "");
+    return LLVMBuildGEP2(builder.get(), cell_type, last, &index, 1, "");
+  };
+
+  const auto constant = [&](std::int32_t value) {
+    return LLVMConstInt(cell_type, std::uint64_t(value), true);
+  };
+
+  std::stack<LLVMBasicBlockRef> stack;
+
+  for (std::size_t index = 0; index < program.size(); ++index) {
+    const auto &node = program[index];
+    if (counted)
+      count(index);
+    switch (node.op) {
+    case op_t::add: {
+      auto ref = cell(node.offset);
+      auto last = LLVMBuildLoad2(builder.get(), cell_type, ref, "");
+      last = LLVMBuildAdd(builder.get(), last, constant(node.value), "");
+      LLVMBuildStore(builder.get(), last, ref);
+      break;
+    }
+    case op_t::move: {
+      LLVMBuildStore(
+          builder.get(),
+          LLVMBuildPointerCast(builder.get(), cell(node.value), ptr_type, ""),
+          ptr);
+      break;
+    }
+    case op_t::set: {
+      LLVMBuildStore(builder.get(), constant(node.value), cell(node.offset));
+      break;
+    }
+    case op_t::mul: {
+      // the target is only touched when the source isn't zero; the tests of
+      // a loop's multiplies all load its counter, so they merge into one
+      auto body = LLVMAppendBasicBlockInContext(ctx, main, "mul");
+      auto next = LLVMAppendBasicBlockInContext(ctx, main, "next");
+
+      auto src = LLVMBuildLoad2(builder.get(), cell_type, cell(node.source),
+                                "");
+      auto last = LLVMBuildICmp(builder.get(), LLVMIntEQ, src, cell_0, "");
+      LLVMBuildCondBr(builder.get(), last, next, body);
+
+      LLVMPositionBuilderAtEnd(builder.get(), body);
+      auto product =
+          LLVMBuildMul(builder.get(), src, constant(node.value), "");
+      auto ref = cell(node.offset);
+      last = LLVMBuildLoad2(builder.get(), cell_type, ref, "");
+      last = LLVMBuildAdd(builder.get(), last, product, "");
+      LLVMBuildStore(builder.get(), last, ref);
+      LLVMBuildBr(builder.get(), next);
+
+      LLVMPositionBuilderAtEnd(builder.get(), next);
+      break;
+    }
+    case op_t::scan: {
+      // test the first cell inline; only call out when there's a walk
+      auto body = LLVMAppendBasicBlockInContext(ctx, main, "scan");
+      auto next = LLVMAppendBasicBlockInContext(ctx, main, "next");
+
+      auto last = LLVMBuildLoad2(builder.get(), cell_type, cell(0), "");
+      last = LLVMBuildICmp(builder.get(), LLVMIntEQ, last, cell_0, "");
+      LLVMBuildCondBr(builder.get(), last, next, body);
+
+      LLVMPositionBuilderAtEnd(builder.get(), body);
+      std::array<LLVMValueRef, 2> args = {
+          LLVMBuildLoad2(builder.get(), ptr_type, ptr, ""),
+          LLVMConstInt(int32_type, std::uint64_t(node.value), true)};
+      last = LLVMBuildCall2(builder.get(), scan_type, scan_fn, args.begin(),
+                            args.size(), "");
+      LLVMBuildStore(builder.get(), last, ptr);
+      LLVMBuildBr(builder.get(), next);
+
+      LLVMPositionBuilderAtEnd(builder.get(), next);
+      break;
+    }
+    case op_t::open: {
+      auto head = LLVMAppendBasicBlockInContext(ctx, main, "head");
+      auto body = LLVMAppendBasicBlockInContext(ctx, main, "body");
+      auto tail = LLVMAppendBasicBlockInContext(ctx, main, "tail");
+      auto next = LLVMAppendBasicBlockInContext(ctx, main, "next");
+
+      stack.push(next);
+      stack.push(tail);
+      stack.push(body);
+      stack.push(head);
+
+      // skip the first test when it's known to pass
+      LLVMBuildBr(builder.get(), node.value ? body : head);
+      LLVMPositionBuilderAtEnd(builder.get(), body);
+      break;
+    }
+    case op_t::close: {
+      auto head = stack.top();
+      stack.pop();
+      auto body = stack.top();
+      stack.pop();
+      auto tail = stack.top();
+      stack.pop();
+      auto next = stack.top();
+      stack.pop();
+
+      LLVMBuildBr(builder.get(), tail);
+
+      {
+        LLVMPositionBuilderAtEnd(builder.get(), head);
+        auto last = LLVMBuildLoad2(builder.get(), cell_type, cell(0), "");
+        last = LLVMBuildICmp(builder.get(), LLVMIntEQ, last, cell_0, "");
+        last = LLVMBuildCondBr(builder.get(), last, next, body);
       }
-      case '.': {
-        auto putc = LLVMBuildLoad2(builder.get(), putc_ptr_type, putc_ptr, "");
-        auto addr = LLVMBuildLoad2(builder.get(), ptr_type, ptr, "");
-        auto arg0 = LLVMBuildLoad2(builder.get(), byte_type, addr, "");
-        auto arg1 =
-            LLVMBuildLoad2(builder.get(), void_ptr_type, capture_ptr, "");
-        std::array<LLVMValueRef, 2> args = {arg0, arg1};
-        LLVMBuildCall2(builder.get(), putc_type, putc, args.begin(),
-                       args.size(), "");
-        break;
+
+      // and the test at the end when it's known to fail
+      LLVMPositionBuilderAtEnd(builder.get(), tail);
+      if (node.value) {
+        LLVMBuildBr(builder.get(), next);
+      } else {
+        auto last = LLVMBuildLoad2(builder.get(), cell_type, cell(0), "");
+        last = LLVMBuildICmp(builder.get(), LLVMIntEQ, last, cell_0, "");
+        last = LLVMBuildCondBr(builder.get(), last, next, head);
       }
-      case ',': {
-        auto getc = LLVMBuildLoad2(builder.get(), getc_ptr_type, getc_ptr, "");
-        auto capture =
-            LLVMBuildLoad2(builder.get(), void_ptr_type, capture_ptr, "");
-        auto result =
-            LLVMBuildCall2(builder.get(), getc_type, getc, &capture, 1, "");
-        auto last = LLVMBuildLoad2(builder.get(), ptr_type, ptr, "");
-        last = LLVMBuildGEP2(builder.get(), byte_type, last, &byte_0, 1, "");
-        last = LLVMBuildStore(builder.get(), result, last);
-        break;
+
+      LLVMPositionBuilderAtEnd(builder.get(), next);
+      break;
+    }
+    case op_t::put: {
+      // append to the output buffer, flushing first if it's full
+      auto flush = LLVMAppendBasicBlockInContext(ctx, main, "flush");
+      auto store = LLVMAppendBasicBlockInContext(ctx, main, "store");
+
+      auto pos_ref =
+          LLVMBuildStructGEP2(builder.get(), buffer_type, buffer, 0, "");
+      auto end_ref =
+          LLVMBuildStructGEP2(builder.get(), buffer_type, buffer, 1, "");
+      auto pos = LLVMBuildLoad2(builder.get(), ptr_type, pos_ref, "");
+      auto end = LLVMBuildLoad2(builder.get(), ptr_type, end_ref, "");
+      auto full = LLVMBuildICmp(builder.get(), LLVMIntEQ, pos, end, "");
+      LLVMBuildCondBr(builder.get(), full, flush, store);
+
+      LLVMPositionBuilderAtEnd(builder.get(), flush);
+      LLVMBuildCall2(builder.get(), flush_type, flush_fn, &output, 1, "");
+      LLVMBuildBr(builder.get(), store);
+
+      LLVMPositionBuilderAtEnd(builder.get(), store);
+      pos = LLVMBuildLoad2(builder.get(), ptr_type, pos_ref, "");
+      auto value =
+          LLVMBuildLoad2(builder.get(), cell_type, cell(node.offset), "");
+      LLVMBuildStore(builder.get(),
+                     LLVMBuildTrunc(builder.get(), value, byte_type, ""), pos);
+      auto one = LLVMConstInt(int64_type, 1, false);
+      LLVMBuildStore(builder.get(),
+                     LLVMBuildGEP2(builder.get(), byte_type, pos, &one, 1,
+                                   ""),
+                     pos_ref);
+      break;
+    }
+    case op_t::write: {
+      // a run of writes is one constant written by one call, however long
+      std::string bytes;
+      for (;; ++index) {
+        const auto &run = program[index];
+        for (std::size_t i = 0; i < std::size_t(run.source); ++i)
+          bytes.push_back(char(brainfk::ir::written(run.value, i)));
+        if (index + 1 == program.size() ||
+            program[index + 1].op != op_t::write)
+          break;
+        if (counted)
+          count(index + 1);
       }
-      default:
-        break;
+      auto init = LLVMConstStringInContext(
+          ctx, bytes.data(), unsigned(bytes.size()), true);
+      auto text = LLVMAddGlobal(module, LLVMTypeOf(init), "");
+      LLVMSetInitializer(text, init);
+      LLVMSetGlobalConstant(text, true);
+      LLVMSetLinkage(text, LLVMPrivateLinkage);
+      LLVMSetUnnamedAddress(text, LLVMGlobalUnnamedAddr);
+
+      std::array args{
+          output, LLVMBuildPointerCast(builder.get(), text, ptr_type, ""),
+          LLVMConstInt(int64_type, bytes.size(), false)};
+      LLVMBuildCall2(builder.get(), write_type, write_fn, args.begin(),
+                     args.size(), "");
+      break;
+    }
+    case op_t::get: {
+      // take the next byte from the input buffer, refilling if it's empty
+      auto refill = LLVMAppendBasicBlockInContext(ctx, main, "refill");
+      auto read = LLVMAppendBasicBlockInContext(ctx, main, "read");
+      auto store = LLVMAppendBasicBlockInContext(ctx, main, "store");
+
+      auto pos_ref =
+          LLVMBuildStructGEP2(builder.get(), buffer_type, in_buffer, 0, "");
+      auto end_ref =
+          LLVMBuildStructGEP2(builder.get(), buffer_type, in_buffer, 1, "");
+      auto pos = LLVMBuildLoad2(builder.get(), ptr_type, pos_ref, "");
+      auto end = LLVMBuildLoad2(builder.get(), ptr_type, end_ref, "");
+      auto empty = LLVMBuildICmp(builder.get(), LLVMIntEQ, pos, end, "");
+      LLVMBuildCondBr(builder.get(), empty, refill, read);
+
+      LLVMPositionBuilderAtEnd(builder.get(), refill);
+      std::array<LLVMValueRef, 2> args = {
+          input, LLVMBuildLoad2(builder.get(), cell_type, cell(node.offset),
+                                "")};
+      auto refilled = LLVMBuildCall2(builder.get(), underflow_type,
+                                     underflow_fn, args.begin(), args.size(),
+                                     "");
+      LLVMBuildBr(builder.get(), store);
+
+      LLVMPositionBuilderAtEnd(builder.get(), read);
+      auto buffered =
+          LLVMBuildZExt(builder.get(),
+                        LLVMBuildLoad2(builder.get(), byte_type, pos, ""),
+                        cell_type, "");
+      auto one = LLVMConstInt(int64_type, 1, false);
+      LLVMBuildStore(builder.get(),
+                     LLVMBuildGEP2(builder.get(), byte_type, pos, &one, 1,
+                                   ""),
+                     pos_ref);
+      LLVMBuildBr(builder.get(), store);
+
+      LLVMPositionBuilderAtEnd(builder.get(), store);
+      auto result = LLVMBuildPhi(builder.get(), cell_type, "");
+      std::array values{refilled, buffered};
+      std::array blocks{refill, read};
+      LLVMAddIncoming(result, values.begin(), blocks.begin(), values.size());
+      LLVMBuildStore(builder.get(), result, cell(node.offset));
+      break;
+    }
+    }
+  }
+
+  LLVMBuildRet(builder.get(),
+               LLVMBuildLoad2(builder.get(), ptr_type, ptr, ""));
+
+  if (LLVMVerifyFunction(main, LLVMReturnStatusAction))
+    throw std::runtime_error("LLVMVerifyFunction failed");
+}
+
+/**
+ * Generate the function name in module which calls parts, functions built
+ * elsewhere, in turn, passing each the tape pointer the last returned.
+ */
+void build_calls(LLVMModuleRef module, std::span<const std::string> parts,
+                 const std::string &name) {
+  auto ctx = LLVMGetModuleContext(module);
+  auto type = entry_type(ctx);
+  auto main = LLVMAddFunction(module, name.c_str(), type);
+  LLVMSetLinkage(main, LLVMExternalLinkage);
+
+  auto builder = llvm_ptr(LLVMDisposeBuilder, LLVMCreateBuilder());
+  LLVMPositionBuilderAtEnd(builder.get(),
+                           LLVMAppendBasicBlockInContext(ctx, main, ""));
+
+  std::array<LLVMValueRef, 5> args;
+  for (unsigned i = 0; i < args.size(); ++i)
+    args[i] = LLVMGetParam(main, i);
+  for (const auto &part : parts) {
+    auto fn = LLVMAddFunction(module, part.c_str(), type);
+    args[0] = LLVMBuildCall2(builder.get(), type, fn, args.begin(),
+                             args.size(), "");
+  }
+  LLVMBuildRet(builder.get(), args[0]);
+
+  if (LLVMVerifyFunction(main, LLVMReturnStatusAction))
+    throw std::runtime_error("LLVMVerifyFunction failed");
+}
+
+/**
+ * Define the constants an ahead of time compiled program's main lays out
+ * its tape by, see runtime.hpp.
+ */
+void build_tape(LLVMModuleRef module, unsigned cell_bits, std::size_t reach) {
+  auto ctx = LLVMGetModuleContext(module);
+  const auto define = [&](const char *name, LLVMTypeRef type,
+                          std::uint64_t value) {
+    auto global = LLVMAddGlobal(module, type, name);
+    LLVMSetInitializer(global, LLVMConstInt(type, value, false));
+    LLVMSetGlobalConstant(global, true);
+  };
+  define("brainfk_cell_bits", LLVMInt32TypeInContext(ctx), cell_bits);
+  define("brainfk_reach", LLVMInt64TypeInContext(ctx), reach);
+}
+
+/**
+ * The nodes per function when a large program is generated as several: the
+ * middle end takes more than linear time in a function's size.
+ */
+constexpr std::size_t part_size = 1 << 13;
+
+/**
+ * Split program between top level loops into parts of at least part_size
+ * nodes, bar the last; a loop is never split, so a program that's one big
+ * loop stays whole.
+ */
+std::vector<brainfk::ir::program_t>
+partition(const brainfk::ir::program_t &program) {
+  using brainfk::ir::op_t;
+
+  std::vector<brainfk::ir::program_t> parts;
+  auto begin = program.begin();
+  std::size_t depth = 0;
+  for (auto i = program.begin(); i != program.end(); ++i) {
+    if (i->op == op_t::open)
+      ++depth;
+    else if (i->op == op_t::close)
+      --depth;
+    if (depth == 0 && std::size_t(i + 1 - begin) >= part_size) {
+      parts.emplace_back(begin, i + 1);
+      begin = i + 1;
+    }
+  }
+  if (begin != program.end() || parts.empty())
+    parts.emplace_back(begin, program.end());
+  return parts;
+}
+
+/**
+ * A program's objects as one cache entry, each preceded by its size.
+ */
+std::vector<std::byte> pack(std::span<const std::vector<std::byte>> objects) {
+  std::vector<std::byte> result;
+  for (const auto &object : objects) {
+    const auto size = std::uint64_t(object.size());
+    const auto bytes = std::as_bytes(std::span(&size, 1));
+    result.insert(result.end(), bytes.begin(), bytes.end());
+    result.insert(result.end(), object.begin(), object.end());
+  }
+  return result;
+}
+
+std::optional<std::vector<std::vector<std::byte>>>
+unpack(std::span<const std::byte> packed) {
+  std::vector<std::vector<std::byte>> result;
+  while (!packed.empty()) {
+    std::uint64_t size;
+    if (packed.size() < sizeof(size))
+      return std::nullopt;
+    std::memcpy(&size, packed.data(), sizeof(size));
+    packed = packed.subspan(sizeof(size));
+    if (packed.size() < size)
+      return std::nullopt;
+    result.emplace_back(packed.begin(), packed.begin() + std::ptrdiff_t(size));
+    packed = packed.subspan(size);
+  }
+  return result;
+}
+
+struct code_t;
+
+} // namespace
+
+/**
+ * The JIT, target machine and LLVM context that a machine's executables are
+ * compiled with; shared by the executables so their code outlives the
+ * machine.
+ */
+struct brainfk::llvm_machine_t::session_t {
+  session_t(brainfk::llvm_options_t options, unsigned cell_bits)
+      : options_(std::move(options)), cell_bits_(cell_bits) {
+    initialize();
+
+    if (options_.level > 3)
+      throw std::runtime_error{
+          std::format("bad optimization level: {}", options_.level)};
+    if (options_.passes.empty())
+      options_.passes = std::format("default<O{}>", options_.level);
+    static constexpr LLVMCodeGenOptLevel levels[] = {
+        LLVMCodeGenLevelNone, LLVMCodeGenLevelLess, LLVMCodeGenLevelDefault,
+        LLVMCodeGenLevelAggressive};
+    level_ = levels[options_.level];
+
+    // generate position independent code for this CPU; the object code is
+    // loaded into the JIT and may be cached
+    char *triple = LLVMGetDefaultTargetTriple();
+    char *cpu = LLVMGetHostCPUName();
+    char *features = LLVMGetHostCPUFeatures();
+    triple_ = triple;
+    cpu_ = cpu;
+    features_ = features;
+    LLVMDisposeMessage(features);
+    LLVMDisposeMessage(cpu);
+    LLVMDisposeMessage(triple);
+
+    char *message = nullptr;
+    if (LLVMGetTargetFromTriple(triple_.c_str(), &target_, &message)) {
+      std::string text{message};
+      LLVMDisposeMessage(message);
+      throw std::runtime_error{
+          std::format("LLVMGetTargetFromTriple failed: {}", text)};
+    }
+    machine_ = create_machine();
+    // and for any CPU of the architecture when compiling ahead of time
+    portable_ = LLVMCreateTargetMachine(
+        target_, triple_.c_str(), "generic", "", level_, LLVMRelocPIC,
+        LLVMCodeModelDefault);
+
+    check(LLVMOrcCreateLLJIT(&jit_, nullptr), "LLVMOrcCreateLLJIT");
+    context_ = LLVMOrcCreateNewThreadSafeContext();
+
+    // the pair's own name changed between llvm versions
+    std::vector<std::remove_pointer_t<LLVMOrcCSymbolMapPairs>> symbols;
+    for (auto [name, address] : runtime_symbols)
+      symbols.push_back(
+          {LLVMOrcLLJITMangleAndIntern(jit_, name),
+           {LLVMOrcExecutorAddress(address),
+            {LLVMJITSymbolGenericFlagsExported |
+                 LLVMJITSymbolGenericFlagsCallable,
+             0}}});
+    check(LLVMOrcJITDylibDefine(
+              LLVMOrcLLJITGetMainJITDylib(jit_),
+              LLVMOrcAbsoluteSymbols(symbols.data(), symbols.size())),
+          "LLVMOrcJITDylibDefine");
+  }
+
+  ~session_t() {
+    LLVMConsumeError(LLVMOrcDisposeLLJIT(jit_));
+    LLVMOrcDisposeThreadSafeContext(context_);
+    LLVMDisposeTargetMachine(portable_);
+    LLVMDisposeTargetMachine(machine_);
+  }
+
+  session_t(const session_t &) = delete;
+  session_t &operator=(const session_t &) = delete;
+
+  /**
+   * Generate code for program with entry point name, for this CPU or any,
+   * counting nodes run if counted. Given the reach of its source, it also
+   * defines the constants an executable's main needs; see build_tape.
+   */
+  std::vector<std::byte> emit(const brainfk::ir::program_t &program,
+                              const std::string &name,
+                              artifact_t artifact = artifact_t::object,
+                              bool portable = false, bool counted = false,
+                              std::optional<std::size_t> reach = {});
+
+  /**
+   * Generate object code for this CPU as emit does, but as several objects
+   * for a large program: its parts (see partition) are generated as
+   * separate functions concurrently, each in its own context with its own
+   * target machine, plus an entry point that calls them in turn.
+   */
+  std::vector<std::vector<std::byte>>
+  emit_parts(const brainfk::ir::program_t &program, const std::string &name);
+
+  /**
+   * A target machine for this CPU; the caller disposes of it.
+   */
+  LLVMTargetMachineRef create_machine() const {
+    return LLVMCreateTargetMachine(target_, triple_.c_str(), cpu_.c_str(),
+                                   features_.c_str(), level_, LLVMRelocPIC,
+                                   LLVMCodeModelDefault);
+  }
+
+  /**
+   * Run the middle end on module then generate artifact with machine; uses
+   * nothing else that's shared.
+   */
+  std::vector<std::byte> generate(LLVMModuleRef module,
+                                  LLVMTargetMachineRef machine,
+                                  artifact_t artifact) const;
+
+  brainfk::llvm_options_t options_;
+  unsigned cell_bits_;
+  // serializes use of everything below, context_ and the target machines
+  // aren't thread safe
+  std::mutex mutex_;
+  std::string triple_;
+  std::string cpu_;
+  std::string features_;
+  LLVMTargetRef target_{};
+  LLVMCodeGenOptLevel level_{};
+  LLVMTargetMachineRef machine_{};
+  LLVMTargetMachineRef portable_{};
+  LLVMOrcLLJITRef jit_{};
+  LLVMOrcThreadSafeContextRef context_{};
+  // code loaded into the jit by cache key; see compile
+  std::unordered_map<std::string, std::weak_ptr<code_t>> code_;
+  std::condition_variable released_;
+};
+
+std::vector<std::byte>
+brainfk::llvm_machine_t::session_t::emit(const ir::program_t &program,
+                                         const std::string &name,
+                                         artifact_t artifact, bool portable,
+                                         bool counted,
+                                         std::optional<std::size_t> reach) {
+  auto ctx = LLVMOrcThreadSafeContextGetContext(context_);
+  auto module =
+      llvm_ptr(LLVMDisposeModule, LLVMModuleCreateWithNameInContext("", ctx));
+  build(module.get(), program, name, cell_bits_, counted);
+  if (reach)
+    build_tape(module.get(), cell_bits_, *reach);
+  return generate(module.get(), portable ? portable_ : machine_, artifact);
+}
+
+std::vector<std::vector<std::byte>>
+brainfk::llvm_machine_t::session_t::emit_parts(const ir::program_t &program,
+                                               const std::string &name) {
+  const auto parts = partition(program);
+  if (parts.size() == 1)
+    return {emit(program, name)};
+
+  std::vector<std::string> names;
+  for (std::size_t i = 0; i < parts.size(); ++i)
+    names.push_back(std::format("{}_{}", name, i));
+
+  std::vector<std::vector<std::byte>> objects(parts.size() + 1);
+  std::atomic<std::size_t> next{0};
+  std::mutex mutex;
+  std::exception_ptr error;
+  const auto work = [&]() {
+    for (std::size_t i; (i = next++) < parts.size();) {
+      try {
+        auto ctx = llvm_ptr(LLVMContextDispose, LLVMContextCreate());
+        auto module =
+            llvm_ptr(LLVMDisposeModule,
+                     LLVMModuleCreateWithNameInContext("", ctx.get()));
+        build(module.get(), parts[i], names[i], cell_bits_);
+        auto machine = llvm_ptr(LLVMDisposeTargetMachine, create_machine());
+        objects[i] = generate(module.get(), machine.get(), artifact_t::object);
+      } catch (...) {
+        std::lock_guard lock{mutex};
+        if (!error)
+          error = std::current_exception();
       }
     }
+  };
+
+  {
+    const auto threads =
+        options_.threads ? options_.threads
+                         : std::max(std::thread::hardware_concurrency(), 1u);
+    std::vector<std::jthread> workers;
+    for (std::size_t i = 1; i < std::min<std::size_t>(threads, parts.size());
+         ++i)
+      workers.emplace_back(work);
+    work();
+  }
+  if (error)
+    std::rethrow_exception(error);
+
+  auto ctx = LLVMOrcThreadSafeContextGetContext(context_);
+  auto module =
+      llvm_ptr(LLVMDisposeModule, LLVMModuleCreateWithNameInContext("", ctx));
+  build_calls(module.get(), names, name);
+  objects.back() = generate(module.get(), machine_, artifact_t::object);
+  return objects;
+}
+
+std::vector<std::byte> brainfk::llvm_machine_t::session_t::generate(
+    LLVMModuleRef module, LLVMTargetMachineRef machine,
+    artifact_t artifact) const {
+  LLVMSetTarget(module, triple_.c_str());
+  auto layout = LLVMCreateTargetDataLayout(machine);
+  LLVMSetModuleDataLayout(module, layout);
+  LLVMDisposeTargetData(layout);
+
+  // the middle end, e.g. promoting the tape pointer from its alloca to ssa
+  // values, then code generation at the matching level
+  {
+    auto options = llvm_ptr(LLVMDisposePassBuilderOptions,
+                            LLVMCreatePassBuilderOptions());
+    check(LLVMRunPasses(module, options_.passes.c_str(), machine,
+                        options.get()),
+          "LLVMRunPasses");
+  }
+
+  char *message = nullptr;
+  if (artifact == artifact_t::llvm_ir) {
+    message = LLVMPrintModuleToString(module);
+    const std::string_view text{message};
+    const auto start = reinterpret_cast<const std::byte *>(text.data());
+    std::vector<std::byte> result{start, start + text.size()};
+    LLVMDisposeMessage(message);
+    return result;
+  }
+
+  LLVMMemoryBufferRef buffer;
+  if (LLVMTargetMachineEmitToMemoryBuffer(
+          machine, module,
+          artifact == artifact_t::assembly ? LLVMAssemblyFile : LLVMObjectFile,
+          &message, &buffer)) {
+    std::string text{message};
+    LLVMDisposeMessage(message);
+    throw std::runtime_error{
+        std::format("LLVMTargetMachineEmitToMemoryBuffer failed: {}", text)};
+  }
+
+  const auto start =
+      reinterpret_cast<const std::byte *>(LLVMGetBufferStart(buffer));
+  std::vector<std::byte> result{start, start + LLVMGetBufferSize(buffer)};
+  LLVMDisposeMemoryBuffer(buffer);
+  return result;
+}
+
+namespace {
+
+using session_ptr_t = std::shared_ptr<brainfk::llvm_machine_t::session_t>;
+using main_t = std::byte *(*)(std::byte *, brainfk::output_t::buffer_t *,
+                              void *, brainfk::input_t::buffer_t *, void *);
+using counted_main_t = std::byte *(*)(std::byte *,
+                                      brainfk::output_t::buffer_t *, void *,
+                                      brainfk::input_t::buffer_t *, void *,
+                                      std::uint64_t *);
+
+/**
+ * A program's code in the jit; the tracker owns it so it's freed with the
+ * last executable using it.
+ */
+struct code_t {
+  code_t(session_ptr_t session, std::string key,
+         LLVMOrcResourceTrackerRef tracker, LLVMOrcExecutorAddress main)
+      : session_(std::move(session)), key_(std::move(key)), tracker_(tracker),
+        main_(main) {}
+
+  /**
+   * The entry point as Main, main_t or counted_main_t as it was built.
+   */
+  template <typename Main> Main main() const {
+    return reinterpret_cast<Main>(main_);
+  }
+
+  ~code_t() {
+    std::lock_guard lock{session_->mutex_};
+    LLVMConsumeError(LLVMOrcResourceTrackerRemove(tracker_));
+    LLVMOrcReleaseResourceTracker(tracker_);
+    session_->code_.erase(key_);
+    session_->released_.notify_all();
+  }
+
+  code_t(const code_t &) = delete;
+  code_t &operator=(const code_t &) = delete;
+
+  session_ptr_t session_;
+  std::string key_;
+  LLVMOrcResourceTrackerRef tracker_;
+  LLVMOrcExecutorAddress main_;
+};
+
+/**
+ * Link a program's objects, with entry point name, into the jit; called
+ * with the session locked.
+ */
+std::shared_ptr<code_t>
+link(const session_ptr_t &session, const std::string &key,
+     const std::string &name,
+     std::span<const std::vector<std::byte>> objects) {
+  auto tracker = LLVMOrcJITDylibCreateResourceTracker(
+      LLVMOrcLLJITGetMainJITDylib(session->jit_));
+  const auto release = [&]() {
+    LLVMConsumeError(LLVMOrcResourceTrackerRemove(tracker));
+    LLVMOrcReleaseResourceTracker(tracker);
+  };
 
-    if (!stack.empty())
-      throw std::runtime_error("unmatched '['");
+  LLVMOrcExecutorAddress address;
+  try {
+    for (const auto &object : objects)
+      check(LLVMOrcLLJITAddObjectFileWithRT(
+                session->jit_, tracker,
+                LLVMCreateMemoryBufferWithMemoryRangeCopy(
+                    reinterpret_cast<const char *>(object.data()),
+                    object.size(), name.c_str())),
+            "LLVMOrcLLJITAddObjectFile");
+    check(LLVMOrcLLJITLookup(session->jit_, &address, name.c_str()),
+          "LLVMOrcLLJITLookup");
+  } catch (...) {
+    release();
+    throw;
+  }
+
+  return std::make_shared<code_t>(session, key, tracker,
+                                  address);
+}
 
-    LLVMBuildRetVoid(builder.get());
+/**
+ * The cache key of code generated by session from source (a program's text)
+ * or ir (e.g. one loop of a program, spelled out since it has no text),
+ * counted or not.
+ */
+std::string key(const session_ptr_t &session, std::string_view source,
+                std::string_view ir = {}, bool counted = false) {
+  return brainfk::code_cache_t::key(
+      source, {counted ? "llvm-8-counted" : "llvm-8",
+               std::format("i{}", session->cell_bits_), session->triple_,
+               session->cpu_, session->features_,
+               // the passes, and the level code generation runs at
+               session->options_.passes,
+               std::format("O{}", session->options_.level), ir});
+}
 
-    if (LLVMVerifyFunction(main, LLVMReturnStatusAction))
-      throw std::runtime_error("LLVMVerifyFunction failed");
+/**
+ * The code for program, shared with any executable already running it since
+ * its entry point name, derived from the cache key, can only be defined
+ * once; otherwise it's loaded from cache or generated. Counted code is
+ * generated whole, not in parts, so each node's index is its own.
+ */
+std::shared_ptr<code_t> compile(const session_ptr_t &session,
+                                const brainfk::code_cache_t *cache,
+                                const std::string &key,
+                                const brainfk::ir::program_t &program,
+                                bool counted = false) {
+  const auto name = std::format("brainfk_main_{}", key);
 
-    LLVMExecutionEngineRef engine;
-    if (LLVMCreateJITCompilerForModule(&engine, module.get(), 3, nullptr))
-      throw std::runtime_error("LLVMCreateJITCompilerForModule failed");
+  std::unique_lock lock{session->mutex_};
+  for (;;) {
+    // code whose last executable was just destroyed is still defined until
+    // its destructor gets the lock
+    session->released_.wait(lock, [&]() {
+      const auto i = session->code_.find(key);
+      return i == session->code_.end() || !i->second.expired();
+    });
+    const auto i = session->code_.find(key);
+    if (i == session->code_.end())
+      break;
+    if (auto code = i->second.lock())
+      return code;
+  }
 
-    exe_ = reinterpret_cast<void (*)(std::byte *, void (*)(std::byte, void *),
-                                     std::byte (*)(void *), void *)>(
-        LLVMGetFunctionAddress(engine, "brainfk_main"));
+  std::shared_ptr<code_t> code;
+  if (cache) {
+    if (auto entry = cache->load(key)) {
+      try {
+        if (auto objects = unpack(*entry))
+          code = link(session, key, name, *objects);
+      } catch (const std::exception &) {
+        // a corrupt entry; regenerate it
+      }
+    }
+  }
+  if (!code) {
+    const auto objects =
+        counted ? std::vector<std::vector<std::byte>>{session->emit(
+                      program, name,
+                      brainfk::llvm_machine_t::artifact_t::object, false, true)}
+                : session->emit_parts(program, name);
+    code = link(session, key, name, objects);
+    if (cache)
+      cache->store(key, pack(objects));
   }
 
-  void (*exe_)(std::byte *, void (*)(std::byte, void *), std::byte (*)(void *),
-               void *);
+  session->code_.emplace(key, code);
+  return code;
+}
+
+/**
+ * Calls generated code, which keeps its state in registers and on the
+ * stack, so it's safe to call from several threads without the session's
+ * lock.
+ */
+struct executable_t : brainfk::executable_t {
+  explicit executable_t(std::shared_ptr<code_t> code)
+      : code_(std::move(code)) {}
 
-  void operator()(std::byte *mem, const brainfk::putc_t &putc,
-                  const brainfk::getc_t &getc) const {
-    using tuple_t =
-        std::tuple<const brainfk::putc_t &, const brainfk::getc_t &>;
-    tuple_t tuple{putc, getc};
-    exe_(
-        mem,
-        [](std::byte c, void *self_) {
-          auto &self = *static_cast<tuple_t *>(self_);
-          std::get<0>(self)(c);
-        },
-        [](void *self_) -> std::byte {
-          auto &self = *static_cast<tuple_t *>(self_);
-          return std::get<1>(self)();
-        },
-        &tuple);
+  std::byte *operator()(std::byte *mem, brainfk::output_t &output,
+                        brainfk::input_t &input) const {
+    return code_->main<main_t>()(mem, &output.buffer(), &output,
+                                 &input.buffer(), &input);
   }
+
+  std::shared_ptr<code_t> code_;
 };
 
 } // namespace
 
+brainfk::llvm_machine_t::llvm_machine_t(llvm_options_t options,
+                                        unsigned cell_bits)
+    : machine_t(cell_bits),
+      session_(std::make_shared<session_t>(std::move(options), cell_bits)) {}
+
+std::vector<std::byte>
+brainfk::llvm_machine_t::emit(std::string_view program, artifact_t artifact) {
+  std::lock_guard lock{session_->mutex_};
+  return session_->emit(ir::evaluate(ir::compile(program)), "brainfk_main",
+                        artifact, true, false, tape_t::reach(program));
+}
+
+brainfk::machine_t::executable_ptr_t
+brainfk::llvm_machine_t::compile(const ir::program_t &program) {
+  std::string text;
+  for (const auto &node : program)
+    std::format_to(std::back_inserter(text), "{} {} {} {};", int(node.op),
+                   node.offset, node.value, node.source);
+  return std::make_unique<::executable_t>(
+      ::compile(session_, cache(), key(session_, "", text), program));
+}
+
+std::byte *brainfk::llvm_machine_t::resume(const executable_ptr_t &exe_,
+                                           std::byte *pointer,
+                                           output_t &output, input_t &input) {
+  auto &exe = *dynamic_cast<::executable_t *>(exe_.get());
+  return exe(pointer, output, input);
+}
+
 brainfk::machine_t::executable_ptr_t
 brainfk::llvm_machine_t::compile_impl(std::string_view program) {
-  return std::make_unique<::executable_t>(program);
+  return std::make_unique<::executable_t>(
+      ::compile(session_, cache(), key(session_, program),
+                ir::evaluate(ir::compile(program))));
 }
 
 void brainfk::llvm_machine_t::execute_impl(
     const brainfk::machine_t::executable_ptr_t &exe_, std::byte *mem,
-    const putc_t &putc, const getc_t &getc) {
+    output_t &output, input_t &input) {
   auto &exe = *dynamic_cast<::executable_t *>(exe_.get());
-  exe(mem, putc, getc);
+  exe(mem, output, input);
+}
+
+std::vector<std::uint64_t>
+brainfk::llvm_machine_t::profile_impl(std::string_view program,
+                                      const tape_t &tape, output_t &output,
+                                      input_t &input) {
+  const auto ir = ir::compile(program);
+  const auto code =
+      ::compile(session_, cache(), key(session_, program, {}, true), ir, true);
+  std::vector<std::uint64_t> result(ir.size());
+  const auto main = code->main<counted_main_t>();
+  tape.run([&]() {
+    main(tape.data(), &output.buffer(), &output, &input.buffer(), &input,
+         result.data());
+  });
+  return result;
 }
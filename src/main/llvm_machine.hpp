@@ -1,13 +1,76 @@
 #ifndef LLVM_MACHINE_HPP
 #define LLVM_MACHINE_HPP
 
+#include "ir.hpp"
 #include "machine.hpp"
 
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
 namespace brainfk {
+
+/**
+ * The middle end pipeline run before code generation: clang's default
+ * pipeline at -O level (0 to 3), or if set passes in opt's -passes syntax,
+ * e.g. "function(sroa,instcombine,gvn)". Code generation is at level.
+ * Large programs are compiled in parts on up to threads threads, 0 for one
+ * per core.
+ */
+struct llvm_options_t {
+  unsigned level = 3;
+  std::string passes{};
+  unsigned threads = 0;
+};
+
 class llvm_machine_t : public machine_t {
+public:
+  /**
+   * The JIT session shared by the machine's executables; defined in
+   * llvm_machine.cpp.
+   */
+  struct session_t;
+
+  explicit llvm_machine_t(llvm_options_t options = {}, unsigned cell_bits = 8);
+
+  /**
+   * What emit generates.
+   */
+  enum class artifact_t { object, assembly, llvm_ir };
+
+  /**
+   * Compile program ahead of time, for any CPU of the host's architecture,
+   * with the entry point brainfk_main and the tape constants declared in
+   * runtime.hpp; link an object with the brainfk-runtime library to make an
+   * executable. Its tape has 30,000 cells of cell_bits.
+   */
+  std::vector<std::byte> emit(std::string_view program, artifact_t artifact);
+
+  using machine_t::compile;
+
+  /**
+   * Compile optimized ir, e.g. a loop of a larger program, rather than text.
+   */
+  executable_ptr_t compile(const ir::program_t &program);
+
+  /**
+   * Execute from pointer, part way through a program, without flushing
+   * output; returns the pointer where the code finished.
+   */
+  std::byte *resume(const executable_ptr_t &executable, std::byte *pointer,
+                    output_t &output, input_t &input);
+
+private:
   executable_ptr_t compile_impl(std::string_view) override;
-  void execute_impl(const executable_ptr_t &, std::byte *, const putc_t &,
-                    const getc_t &) override;
+  void execute_impl(const executable_ptr_t &, std::byte *, output_t &,
+                    input_t &) override;
+  std::vector<std::uint64_t> profile_impl(std::string_view, const tape_t &,
+                                          output_t &, input_t &) override;
+
+  std::shared_ptr<session_t> session_;
 };
 } // namespace brainfk
 
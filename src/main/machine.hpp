@@ -1,39 +1,177 @@
 #ifndef ENGINE_HPP
 #define ENGINE_HPP
 
+#include "cache.hpp"
+#include "checkpoint.hpp"
+#include "io.hpp"
+
 #include <cstddef>
+#include <cstdint>
+#include <format>
 #include <functional>
 #include <memory>
+#include <optional>
+#include <stdexcept>
 #include <string_view>
+#include <type_traits>
+#include <vector>
 
 namespace brainfk {
 
-using putc_t = std::function<void(std::byte)>;
-using getc_t = std::function<std::byte()>;
+class tape_t;
+
+/**
+ * Call f with std::type_identity of the unsigned type of cells bits wide,
+ * 8, 16 or 32, so it can instantiate code for that width; throws for any
+ * other. A cell wraps around at its width, input zero extends a byte into
+ * it and output writes its low byte.
+ */
+template <typename F> decltype(auto) with_cell(unsigned bits, F &&f) {
+  switch (bits) {
+  case 8:
+    return f(std::type_identity<std::uint8_t>{});
+  case 16:
+    return f(std::type_identity<std::uint16_t>{});
+  case 32:
+    return f(std::type_identity<std::uint32_t>{});
+  }
+  throw std::runtime_error{std::format("bad cell width: {}", bits)};
+}
 
 struct executable_t {
   virtual ~executable_t() = default;
 };
 
+/**
+ * Executables don't change once compiled, so several threads may execute
+ * them at once, the same one included, each with its own tape, output and
+ * input. compile and cache aren't safe to call concurrently with anything
+ * else on the same machine.
+ */
 class machine_t {
 public:
   using executable_ptr_t = std::unique_ptr<executable_t>;
 
+  /**
+   * The width of the tape's cells in bits; a tape for this machine needs
+   * cell_bits() / 8 bytes a cell.
+   */
+  unsigned cell_bits() const { return cell_bits_; }
+
   executable_ptr_t compile(std::string_view program) {
     return compile_impl(program);
   }
 
+  /**
+   * Execute through putc and getc. Not for tape_t::run, which may abandon
+   * it along with the adapters it makes of them.
+   */
   void execute(const executable_ptr_t &executable, std::byte *mem,
                const putc_t &putc, const getc_t &getc) {
-    return execute_impl(executable, mem, putc, getc);
+    putc_output_t output{putc};
+    getc_input_t input{getc};
+    execute(executable, mem, output, input);
+  }
+
+  /**
+   * Execute writing into output's buffer and reading from input's; output
+   * is flushed before input is refilled and when the program finishes.
+   * mem must be a zeroed tape: compiling assumes programs start on one, so
+   * drops loops on cells they haven't written and may have run what comes
+   * before the first input already. Clears are kept, so a program that
+   * clears the cells it uses before reading them may reuse a tape.
+   */
+  void execute(const executable_ptr_t &executable, std::byte *mem,
+               output_t &output, input_t &input) {
+    input.tie(&output);
+    execute_impl(executable, mem, output, input);
+    output.flush();
+  }
+
+  /**
+   * Execute from position from, on mem as the run that stopped there left
+   * it, stopping at the next back edge a loop takes once suspend is due;
+   * returns where it stopped or nullopt once the program finishes. A
+   * position is the same on every machine, so a run may stop on one and
+   * carry on on another. A machine that can't stop part way runs to the
+   * end, and throws std::runtime_error if from isn't the start.
+   */
+  std::optional<position_t> execute(const executable_ptr_t &executable,
+                                    std::byte *mem, output_t &output,
+                                    input_t &input, suspend_t &suspend,
+                                    position_t from = {}) {
+    input.tie(&output);
+    auto result =
+        suspendable_impl(executable, mem, output, input, suspend, from);
+    output.flush();
+    return result;
+  }
+
+  /**
+   * Whether execute with a suspend_t can stop executable part way, or only
+   * runs it to the end.
+   */
+  bool can_suspend(const executable_ptr_t &executable) const {
+    return can_suspend_impl(executable);
+  }
+
+  /**
+   * Compile and execute program counting how many times each node of
+   * ir::compile(program) runs, by index; a loop's open counts the times
+   * it's entered and its close the iterations. Slower than execute. It
+   * calls tape_t::run itself, around just the code on the tape, so
+   * nothing it owns is abandoned if the program runs off an end.
+   */
+  std::vector<std::uint64_t> profile(std::string_view program,
+                                     const tape_t &tape, output_t &output,
+                                     input_t &input) {
+    input.tie(&output);
+    auto result = profile_impl(program, tape, output, input);
+    output.flush();
+    return result;
+  }
+
+  /**
+   * Look compiled programs up in, and add them to, cache; null (the
+   * default) disables caching. Machines built on others pass it on.
+   */
+  virtual void cache(std::shared_ptr<const code_cache_t> cache) {
+    cache_ = std::move(cache);
   }
 
   virtual ~machine_t() = default;
 
+protected:
+  explicit machine_t(unsigned cell_bits = 8) : cell_bits_(cell_bits) {
+    with_cell(cell_bits, [](auto) {});
+  }
+
+  const code_cache_t *cache() const { return cache_.get(); }
+
 private:
   virtual executable_ptr_t compile_impl(std::string_view) = 0;
-  virtual void execute_impl(const executable_ptr_t &, std::byte *,
-                            const putc_t &, const getc_t &) = 0;
+  virtual void execute_impl(const executable_ptr_t &, std::byte *, output_t &,
+                            input_t &) = 0;
+  /**
+   * Runs execute_impl when from is the start; see checkpoint.cpp.
+   */
+  virtual std::optional<position_t>
+  suspendable_impl(const executable_ptr_t &, std::byte *, output_t &,
+                   input_t &, suspend_t &, position_t from);
+  /**
+   * False, to go with suspendable_impl.
+   */
+  virtual bool can_suspend_impl(const executable_ptr_t &) const;
+  /**
+   * Runs the program's bytecode on an interpreter that counts as it goes
+   * unless a machine can count in its own code; see profile.cpp.
+   */
+  virtual std::vector<std::uint64_t> profile_impl(std::string_view,
+                                                  const tape_t &, output_t &,
+                                                  input_t &);
+
+  unsigned cell_bits_;
+  std::shared_ptr<const code_cache_t> cache_;
 };
 
 } // namespace brainfk
@@ -0,0 +1,43 @@
+#include "machines.hpp"
+#include "auto_machine.hpp"
+#include "handrolled_machine.hpp"
+#include "llvm_machine.hpp"
+#include "tiered_machine.hpp"
+
+#include <array>
+#include <format>
+#include <stdexcept>
+
+namespace {
+
+constexpr std::array<std::string_view, 5> names{
+    "handrolled",
+    "threaded",
+    "llvm",
+    "tiered",
+    "auto",
+};
+
+} // namespace
+
+std::span<const std::string_view> brainfk::machine_names() { return names; }
+
+std::unique_ptr<brainfk::machine_t>
+brainfk::make_machine(std::string_view name, const llvm_options_t &llvm,
+                      unsigned cell_bits) {
+  using dispatch_t = handrolled_machine_t::dispatch_t;
+  if (name == "handrolled")
+    return std::make_unique<handrolled_machine_t>(dispatch_t::switch_loop,
+                                                  cell_bits);
+  if (name == "threaded")
+    return std::make_unique<handrolled_machine_t>(dispatch_t::threaded,
+                                                  cell_bits);
+  if (name == "llvm")
+    return std::make_unique<llvm_machine_t>(llvm, cell_bits);
+  if (name == "tiered")
+    return std::make_unique<tiered_machine_t>(
+        llvm, tiered_machine_t::default_hot, cell_bits);
+  if (name == "auto")
+    return std::make_unique<auto_machine_t>(llvm, cell_bits);
+  throw std::runtime_error(std::format("bad machine: {}", name));
+}
@@ -0,0 +1,29 @@
+#ifndef BRAINFK_MACHINES_HPP
+#define BRAINFK_MACHINES_HPP
+
+#include "llvm_machine.hpp"
+#include "machine.hpp"
+
+#include <memory>
+#include <span>
+#include <string_view>
+
+namespace brainfk {
+
+/**
+ * The names accepted by make_machine, e.g. for -m.
+ */
+std::span<const std::string_view> machine_names();
+
+/**
+ * Construct the machine with the given name for cells of cell_bits; throws
+ * on an unknown name or width. The llvm, tiered and auto machines are
+ * constructed with llvm.
+ */
+std::unique_ptr<machine_t> make_machine(std::string_view name,
+                                        const llvm_options_t &llvm = {},
+                                        unsigned cell_bits = 8);
+
+} // namespace brainfk
+
+#endif // BRAINFK_MACHINES_HPP
@@ -0,0 +1,138 @@
+#include "perf.hpp"
+
+#include <cstring>
+#include <iterator>
+#include <utility>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+using counts_t = brainfk::perf_counts_t;
+
+// in the order of perf_counters_t::fds_
+constexpr std::optional<std::uint64_t> counts_t::*events[] = {
+    &counts_t::cycles,     &counts_t::instructions, &counts_t::branch_misses,
+    &counts_t::l1d_misses, &counts_t::l1i_misses,
+};
+
+#if defined(__linux__)
+
+constexpr std::uint64_t read_miss(std::uint64_t cache) {
+  return cache | PERF_COUNT_HW_CACHE_OP_READ << 8 |
+         PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+}
+
+constexpr std::pair<std::uint32_t, std::uint64_t> configs[] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {PERF_TYPE_HW_CACHE, read_miss(PERF_COUNT_HW_CACHE_L1D)},
+    {PERF_TYPE_HW_CACHE, read_miss(PERF_COUNT_HW_CACHE_L1I)},
+};
+
+/**
+ * A counter of the event for the calling thread in user space, or -1.
+ * Each is opened on its own rather than as a group so one the CPU lacks
+ * doesn't take the others with it.
+ */
+int open_counter(std::uint32_t type, std::uint64_t config) {
+  perf_event_attr attr;
+  std::memset(&attr, 0, sizeof attr);
+  attr.size = sizeof attr;
+  attr.type = type;
+  attr.config = config;
+  attr.read_format =
+      PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return int(::syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+}
+
+#endif
+
+} // namespace
+
+brainfk::perf_counts_t &
+brainfk::perf_counts_t::operator+=(const perf_counts_t &other) {
+  // nothing added yet, so no event has been lost
+  if (*this == perf_counts_t{})
+    return *this = other;
+
+  time += other.time;
+  for (const auto event : events) {
+    if (this->*event && other.*event)
+      *(this->*event) += *(other.*event);
+    else
+      this->*event = std::nullopt;
+  }
+  return *this;
+}
+
+brainfk::perf_counters_t::perf_counters_t()
+    : start_(std::chrono::steady_clock::now()) {
+  fds_.fill(-1);
+#if defined(__linux__)
+  for (std::size_t i = 0; i < fds_.size(); ++i)
+    fds_[i] = open_counter(configs[i].first, configs[i].second);
+#endif
+}
+
+brainfk::perf_counters_t::~perf_counters_t() {
+#if defined(__linux__)
+  for (const auto fd : fds_)
+    if (fd != -1)
+      ::close(fd);
+#endif
+}
+
+brainfk::perf_counters_t::mark_t brainfk::perf_counters_t::mark() const {
+  mark_t result;
+#if defined(__linux__)
+  for (std::size_t i = 0; i < fds_.size(); ++i) {
+    std::array<std::uint64_t, 3> values;
+    if (fds_[i] != -1 &&
+        ::read(fds_[i], values.data(), sizeof values) == sizeof values)
+      result.events[i] = values;
+  }
+#endif
+  result.time = std::chrono::steady_clock::now();
+  return result;
+}
+
+brainfk::perf_counts_t
+brainfk::perf_counters_t::between(const mark_t &from, const mark_t &to) {
+  perf_counts_t result;
+  for (std::size_t i = 0; i < std::size(events); ++i) {
+    if (!from.events[i] || !to.events[i])
+      continue;
+    // each reading only ever grows
+    const auto &[value, enabled, running] = *to.events[i];
+    const auto &[value_0, enabled_0, running_0] = *from.events[i];
+    const auto counted = value - value_0;
+    const auto total = enabled - enabled_0;
+    const auto share = running - running_0;
+    // not scheduled on the PMU at all counts as nothing
+    result.*events[i] =
+        share == total || !share
+            ? counted
+            : std::uint64_t(double(counted) * double(total) / double(share));
+  }
+  result.time = to.time - from.time;
+  return result;
+}
+
+brainfk::perf_counts_t brainfk::perf_counters_t::read() const {
+  // every counter starts from zero
+  mark_t start;
+  for (std::size_t i = 0; i < fds_.size(); ++i) {
+    if (fds_[i] != -1)
+      start.events[i].emplace();
+  }
+  start.time = start_;
+  return since(start);
+}
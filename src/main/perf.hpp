@@ -0,0 +1,86 @@
+#ifndef BRAINFK_PERF_HPP
+#define BRAINFK_PERF_HPP
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+
+namespace brainfk {
+
+/**
+ * Wall time and hardware event counts, in user space, over some span of a
+ * thread's execution. An event is empty when it couldn't be counted: not
+ * on Linux, no PMU (e.g. in many VMs) or perf_event_paranoid too high.
+ */
+struct perf_counts_t {
+  std::chrono::nanoseconds time{};
+  std::optional<std::uint64_t> cycles{};
+  std::optional<std::uint64_t> instructions{};
+  std::optional<std::uint64_t> branch_misses{};
+  std::optional<std::uint64_t> l1d_misses{};
+  std::optional<std::uint64_t> l1i_misses{};
+
+  /**
+   * Events empty in either are empty in the result, except that a default
+   * perf_counts_t, as totals start out, takes other's as they are.
+   */
+  perf_counts_t &operator+=(const perf_counts_t &other);
+
+  bool operator==(const perf_counts_t &) const = default;
+};
+
+/**
+ * The calling thread's counters, running from construction on; take a mark
+ * before something and the counts since it after. Counts are scaled up if
+ * the kernel had to multiplex the events, so they're estimates then. Only
+ * use them on the constructing thread.
+ */
+class perf_counters_t {
+public:
+  /**
+   * The raw readings at some point: each event's count, time enabled and
+   * time running, empty if it couldn't be read.
+   */
+  struct mark_t {
+    std::array<std::optional<std::array<std::uint64_t, 3>>, 5> events{};
+    std::chrono::steady_clock::time_point time{};
+  };
+
+  perf_counters_t();
+  ~perf_counters_t();
+
+  perf_counters_t(const perf_counters_t &) = delete;
+  perf_counters_t &operator=(const perf_counters_t &) = delete;
+
+  mark_t mark() const;
+
+  /**
+   * The counts from one mark to a later one. Each event's are scaled by its
+   * own running time over the span, so they can't come out negative as the
+   * difference of two separately scaled totals can.
+   */
+  static perf_counts_t between(const mark_t &from, const mark_t &to);
+
+  /**
+   * between(from, mark()).
+   */
+  perf_counts_t since(const mark_t &from) const {
+    return between(from, mark());
+  }
+
+  /**
+   * The counts since construction.
+   */
+  perf_counts_t read() const;
+
+private:
+  // cycles, instructions, branch misses, l1d and l1i read misses; -1 for
+  // those that couldn't be opened
+  std::array<int, 5> fds_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+} // namespace brainfk
+
+#endif // BRAINFK_PERF_HPP
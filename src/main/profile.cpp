@@ -0,0 +1,169 @@
+#include "profile.hpp"
+#include "bytecode.hpp"
+#include "ir.hpp"
+#include "machine.hpp"
+#include "tape.hpp"
+
+#include <algorithm>
+#include <format>
+#include <iterator>
+#include <map>
+#include <optional>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+/**
+ * Finds the 1-based line and column of an index into source.
+ */
+class lines_t {
+public:
+  explicit lines_t(std::string_view source) {
+    starts_.push_back(0);
+    for (std::size_t i = 0; i < source.size(); ++i) {
+      if (source[i] == '\n')
+        starts_.push_back(i + 1);
+    }
+  }
+
+  std::size_t size() const { return starts_.size(); }
+
+  /**
+   * The 0-based line of origin.
+   */
+  std::size_t line(std::size_t origin) const {
+    return std::size_t(std::ranges::upper_bound(starts_, origin) -
+                       starts_.begin()) -
+           1;
+  }
+
+  std::string where(std::size_t origin) const {
+    const auto i = line(origin);
+    return std::format("{}:{}", i + 1, origin - starts_[i] + 1);
+  }
+
+  std::size_t start(std::size_t line) const { return starts_[line]; }
+
+private:
+  std::vector<std::size_t> starts_;
+};
+
+/**
+ * The program counts were taken of; they must match.
+ */
+brainfk::ir::program_t compile(std::string_view source,
+                               std::span<const std::uint64_t> counts) {
+  auto program = brainfk::ir::compile(source);
+  if (program.size() != counts.size())
+    throw std::runtime_error{
+        std::format("profile of {} nodes doesn't match a program of {}",
+                    counts.size(), program.size())};
+  return program;
+}
+
+} // namespace
+
+std::vector<std::uint64_t>
+brainfk::machine_t::profile_impl(std::string_view program,
+                                 const tape_t &tape, output_t &output,
+                                 input_t &input) {
+  // an instruction's index is its node's
+  const auto instructions = bytecode::lower(ir::compile(program));
+  std::vector<std::uint64_t> result(instructions.size());
+  bytecode::sequence_counts_t sequences{};
+  tape.run([&]() {
+    with_cell(cell_bits(), [&]<typename Cell>(std::type_identity<Cell>) {
+      bytecode::profile<Cell>(instructions, tape.data(), output, input,
+                              result, sequences);
+    });
+  });
+  return result;
+}
+
+std::string brainfk::profile_listing(std::string_view source,
+                                     std::span<const std::uint64_t> counts) {
+  using ir::op_t;
+
+  const auto program = compile(source, counts);
+  const lines_t lines{source};
+
+  // lines without nodes, e.g. comments, are left blank
+  std::vector<std::optional<std::uint64_t>> per_line(lines.size());
+  for (std::size_t i = 0; i < program.size(); ++i) {
+    auto &count = per_line[lines.line(program[i].origin)];
+    count = count.value_or(0) + counts[i];
+  }
+
+  std::string result;
+  auto out = std::back_inserter(result);
+  std::format_to(out, "{:>14} | source\n", "count");
+  for (std::size_t i = 0; i < lines.size(); ++i) {
+    const auto end = i + 1 < lines.size() ? lines.start(i + 1) - 1
+                                          : source.size();
+    const auto text = source.substr(lines.start(i), end - lines.start(i));
+    if (i + 1 == lines.size() && text.empty())
+      break;
+    if (per_line[i])
+      std::format_to(out, "{:>14} | {}\n", *per_line[i], text);
+    else
+      std::format_to(out, "{:>14} | {}\n", "", text);
+  }
+
+  struct loop_t {
+    std::size_t open;
+    std::size_t close;
+  };
+  std::vector<loop_t> loops;
+  std::vector<std::size_t> opens;
+  for (std::size_t i = 0; i < program.size(); ++i) {
+    if (program[i].op == op_t::open) {
+      opens.push_back(i);
+    } else if (program[i].op == op_t::close) {
+      loops.push_back({opens.back(), i});
+      opens.pop_back();
+    }
+  }
+  std::ranges::stable_sort(loops, std::greater{}, [&](const loop_t &loop) {
+    return counts[loop.close];
+  });
+
+  std::format_to(out, "\n{:>14} {:>20} {:>20}\n", "loop", "entries",
+                 "iterations");
+  for (const auto &loop : loops)
+    std::format_to(out, "{:>14} {:>20} {:>20}\n",
+                   lines.where(program[loop.open].origin), counts[loop.open],
+                   counts[loop.close]);
+  return result;
+}
+
+std::string brainfk::profile_stacks(std::string_view name,
+                                    std::string_view source,
+                                    std::span<const std::uint64_t> counts) {
+  using ir::op_t;
+
+  const auto program = compile(source, counts);
+  const lines_t lines{source};
+
+  std::map<std::string, std::uint64_t> stacks;
+  std::vector<std::string> frames{std::string(name)};
+  for (std::size_t i = 0; i < program.size(); ++i) {
+    // entering a loop is the work of the enclosing one, iterating its own
+    if (program[i].op == op_t::close) {
+      stacks[frames.back()] += counts[i];
+      frames.pop_back();
+      continue;
+    }
+    stacks[frames.back()] += counts[i];
+    if (program[i].op == op_t::open)
+      frames.push_back(std::format("{};loop@{}", frames.back(),
+                                   lines.where(program[i].origin)));
+  }
+
+  std::string result;
+  for (const auto &[stack, count] : stacks) {
+    if (count)
+      std::format_to(std::back_inserter(result), "{} {}\n", stack, count);
+  }
+  return result;
+}
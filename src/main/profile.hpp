@@ -0,0 +1,30 @@
+#ifndef BRAINFK_PROFILE_HPP
+#define BRAINFK_PROFILE_HPP
+
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+
+namespace brainfk {
+
+/**
+ * source annotated with counts from machine_t::profile: each line that
+ * still has code after optimizing prefixed with how many times its nodes
+ * ran, then each loop by line and column with its entries and iterations,
+ * most iterations first.
+ */
+std::string profile_listing(std::string_view source,
+                            std::span<const std::uint64_t> counts);
+
+/**
+ * counts as collapsed stacks, as read by flamegraph.pl and speedscope: a
+ * line per nest of loops, e.g. "name;loop@3:5;loop@4:1 42", with the nodes
+ * run in the innermost loop outside any loop nested in it.
+ */
+std::string profile_stacks(std::string_view name, std::string_view source,
+                           std::span<const std::uint64_t> counts);
+
+} // namespace brainfk
+
+#endif // BRAINFK_PROFILE_HPP
@@ -1,41 +1,222 @@
 #include "repl.hpp"
-#include "handrolled_machine.hpp"
-#include "llvm_machine.hpp"
+#include "aot.hpp"
+#include "batch.hpp"
+#include "checkpoint.hpp"
+#include "machines.hpp"
+#include "profile.hpp"
 #include "readline.hpp"
+#include "source.hpp"
+#include "stats_machine.hpp"
+#include "tape.hpp"
 #include "util.hpp"
 
+#include <atomic>
 #include <cassert>
+#include <charconv>
+#include <chrono>
+#include <csignal>
 #include <cstdio>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <map>
 #include <memory>
 #include <optional>
 #include <regex>
+#include <sstream>
+#include <stdexcept>
 #include <string_view>
 
+#include <getopt.h>
+#include <sysexits.h>
 #include <unistd.h>
 
 namespace {
 
+/**
+ * A cache in code_cache_t::default_directory(), or none without one.
+ */
+std::shared_ptr<const brainfk::code_cache_t> default_cache() {
+  const auto directory = brainfk::code_cache_t::default_directory();
+  return directory ? std::make_shared<brainfk::code_cache_t>(*directory)
+                   : nullptr;
+}
+
 struct settings_t {
-  std::unique_ptr<brainfk::machine_t> machine =
-      std::make_unique<brainfk::handrolled_machine_t>();
+  std::unique_ptr<brainfk::machine_t> machine;
+  std::string machine_name = "handrolled";
+  brainfk::llvm_options_t llvm{};
   std::optional<std::string> script_name{};
+  brainfk::input_t::eof_t eof = brainfk::input_t::eof_t::minus_one;
+  std::shared_ptr<const brainfk::code_cache_t> cache = default_cache();
+  std::optional<brainfk::emit_t> emit{};
+  std::optional<std::string> output{};
+  std::size_t tape_size = brainfk::tape_t::default_size;
+  std::size_t tape_before = 0;
+  unsigned cell_bits = 8;
+  std::optional<std::string> batch{};
+  unsigned jobs = 0;
+  std::optional<std::string> profile{};
+  std::optional<std::string> checkpoint{};
+  std::optional<std::uint64_t> checkpoint_after{};
+  std::optional<std::string> resume{};
+  /**
+   * machine, when --stats wraps it to measure compiles and executes.
+   */
+  const brainfk::stats_machine_t *stats = nullptr;
 };
 
+brainfk::input_t::eof_t parse_eof(std::string_view name) {
+  using eof_t = brainfk::input_t::eof_t;
+  if (name == "zero")
+    return eof_t::zero;
+  if (name == "minus-one")
+    return eof_t::minus_one;
+  if (name == "unchanged")
+    return eof_t::unchanged;
+  throw std::runtime_error{std::format("bad eof policy: {}", name)};
+}
+
+unsigned parse_level(std::string_view level) {
+  if (level.size() == 1 && level[0] >= '0' && level[0] <= '3')
+    return unsigned(level[0] - '0');
+  throw std::runtime_error{std::format("bad optimization level: {}", level)};
+}
+
+/**
+ * A number of cells, optionally suffixed K, M or G.
+ */
+std::size_t parse_size(std::string_view size) {
+  const auto bad = [&]() {
+    return std::runtime_error{std::format("bad tape size: {}", size)};
+  };
+
+  std::size_t result = 0;
+  const auto [end, ec] =
+      std::from_chars(size.data(), size.data() + size.size(), result);
+  if (ec != std::errc{})
+    throw bad();
+
+  const std::string_view suffix{end, size.data() + size.size()};
+  unsigned shift = 0;
+  if (suffix == "K")
+    shift = 10;
+  else if (suffix == "M")
+    shift = 20;
+  else if (suffix == "G")
+    shift = 30;
+  else if (!suffix.empty())
+    throw bad();
+  if (result > (SIZE_MAX >> shift))
+    throw bad();
+  return result << shift;
+}
+
+unsigned parse_cell_bits(std::string_view bits) {
+  unsigned result = 0;
+  const auto [end, ec] =
+      std::from_chars(bits.data(), bits.data() + bits.size(), result);
+  if (ec != std::errc{} || end != bits.data() + bits.size() ||
+      (result != 8 && result != 16 && result != 32))
+    throw std::runtime_error{std::format("bad cell width: {}", bits)};
+  return result;
+}
+
+unsigned parse_jobs(std::string_view jobs) {
+  unsigned result = 0;
+  const auto [end, ec] =
+      std::from_chars(jobs.data(), jobs.data() + jobs.size(), result);
+  if (ec != std::errc{} || end != jobs.data() + jobs.size())
+    throw std::runtime_error{std::format("bad number of jobs: {}", jobs)};
+  return result;
+}
+
+std::uint64_t parse_steps(std::string_view steps) {
+  std::uint64_t result = 0;
+  const auto [end, ec] =
+      std::from_chars(steps.data(), steps.data() + steps.size(), result);
+  if (ec != std::errc{} || end != steps.data() + steps.size())
+    throw std::runtime_error{std::format("bad number of steps: {}", steps)};
+  return result;
+}
+
 settings_t parse_cmdline(int argc, const char *argv[]) {
-  using namespace std::literals;
   settings_t result;
+  bool stats = false;
+
+  static const option long_options[] = {
+      {"emit", required_argument, nullptr, 'E'},
+      {"output", required_argument, nullptr, 'o'},
+      {"passes", required_argument, nullptr, 'P'},
+      {"tape-size", required_argument, nullptr, 'T'},
+      {"tape-before", required_argument, nullptr, 'B'},
+      {"cell-bits", required_argument, nullptr, 'W'},
+      {"batch", required_argument, nullptr, 'b'},
+      {"jobs", required_argument, nullptr, 'j'},
+      {"profile", required_argument, nullptr, 'p'},
+      {"stats", no_argument, nullptr, 'S'},
+      {"checkpoint", required_argument, nullptr, 'K'},
+      {"checkpoint-after", required_argument, nullptr, 'A'},
+      {"resume", required_argument, nullptr, 'R'},
+      {nullptr, 0, nullptr, 0},
+  };
 
   int c;
-  while ((c = getopt(argc, const_cast<char **>(argv), ":m:")) != -1) {
+  while ((c = getopt_long(argc, const_cast<char **>(argv), ":m:e:Co:O:j:",
+                          long_options, nullptr)) != -1) {
     switch (c) {
     case 'm':
-      if (optarg == "llvm"sv) {
-        result.machine = std::make_unique<brainfk::llvm_machine_t>();
-      } else if (optarg == "handrolled"sv) {
-        result.machine = std::make_unique<brainfk::handrolled_machine_t>();
-      } else {
-        throw std::runtime_error("bad machine");
-      }
+      result.machine_name = optarg;
+      break;
+    case 'O':
+      result.llvm.level = parse_level(optarg);
+      break;
+    case 'P':
+      result.llvm.passes = optarg;
+      break;
+    case 'e':
+      result.eof = parse_eof(optarg);
+      break;
+    case 'C':
+      result.cache = nullptr;
+      break;
+    case 'E':
+      result.emit = brainfk::parse_emit(optarg);
+      break;
+    case 'o':
+      result.output = optarg;
+      break;
+    case 'T':
+      result.tape_size = parse_size(optarg);
+      break;
+    case 'B':
+      result.tape_before = parse_size(optarg);
+      break;
+    case 'W':
+      result.cell_bits = parse_cell_bits(optarg);
+      break;
+    case 'b':
+      result.batch = optarg;
+      break;
+    case 'j':
+      result.jobs = parse_jobs(optarg);
+      break;
+    case 'p':
+      result.profile = optarg;
+      break;
+    case 'S':
+      stats = true;
+      break;
+    case 'K':
+      result.checkpoint = optarg;
+      break;
+    case 'A':
+      result.checkpoint_after = parse_steps(optarg);
+      break;
+    case 'R':
+      result.resume = optarg;
       break;
     case ':':
       printf("-%c without argument\n", optopt);
@@ -46,6 +227,15 @@ settings_t parse_cmdline(int argc, const char *argv[]) {
     }
   }
 
+  result.machine = brainfk::make_machine(result.machine_name, result.llvm,
+                                         result.cell_bits);
+  if (stats) {
+    auto machine =
+        std::make_unique<brainfk::stats_machine_t>(std::move(result.machine));
+    result.stats = machine.get();
+    result.machine = std::move(machine);
+  }
+
   if (optind < argc) {
     result.script_name = argv[optind];
   }
@@ -53,6 +243,174 @@ settings_t parse_cmdline(int argc, const char *argv[]) {
   return result;
 }
 
+std::string read_file(const std::filesystem::path &path) {
+  std::ifstream file{path, std::ios::binary};
+  if (!file)
+    throw std::runtime_error{std::format("can't open {}", path.string())};
+  return {std::istreambuf_iterator<char>(file), {}};
+}
+
+void write_file(const std::filesystem::path &path, std::string_view text) {
+  std::ofstream file{path, std::ios::binary | std::ios::trunc};
+  file.write(text.data(), std::streamsize(text.size()));
+  if (!file)
+    throw std::runtime_error{std::format("can't write {}", path.string())};
+}
+
+/**
+ * Run each line of the manifest, "program [input [output]]" with paths
+ * relative to the manifest, writing output to the output file or else to
+ * stdout in manifest order; "-" stands for no input or stdout. A line per
+ * task with its time, and any error, goes to stderr. Blank lines and those
+ * starting with # are skipped.
+ */
+int batch_main(const settings_t &settings, FILE *outstream) {
+  struct line_t {
+    std::string program;
+    std::string input;
+    std::string output;
+  };
+
+  const std::filesystem::path manifest{*settings.batch};
+  std::istringstream lines{read_file(manifest)};
+  std::vector<line_t> entries;
+  for (std::string line; std::getline(lines, line);) {
+    std::istringstream fields{line};
+    line_t entry;
+    if (!(fields >> entry.program) || entry.program.starts_with('#'))
+      continue;
+    fields >> entry.input >> entry.output;
+    if (entry.input == "-")
+      entry.input.clear();
+    if (entry.output == "-")
+      entry.output.clear();
+    entries.push_back(std::move(entry));
+  }
+
+  // each distinct program is read and compiled once
+  const auto directory = manifest.parent_path();
+  std::vector<std::string> programs;
+  std::map<std::string, std::size_t> indices;
+  std::vector<brainfk::batch_task_t> tasks;
+  for (const auto &entry : entries) {
+    auto [i, added] = indices.try_emplace(entry.program, programs.size());
+    if (added)
+      programs.push_back(read_file(directory / entry.program));
+    tasks.push_back({i->second, entry.input.empty()
+                                    ? std::string{}
+                                    : read_file(directory / entry.input)});
+  }
+
+  const auto results = brainfk::run_batch(
+      *settings.machine, programs, tasks,
+      {settings.jobs, settings.tape_size, settings.tape_before, settings.eof});
+
+  auto status = EXIT_SUCCESS;
+  for (std::size_t i = 0; i < results.size(); ++i) {
+    const auto &entry = entries[i];
+    const auto &result = results[i];
+    if (entry.output.empty()) {
+      fwrite(result.output.data(), 1, result.output.size(), outstream);
+    } else if (std::ofstream file{directory / entry.output, std::ios::binary};
+               !(file << result.output)) {
+      throw std::runtime_error{
+          std::format("can't write {}", (directory / entry.output).string())};
+    }
+
+    const std::chrono::duration<double, std::milli> ms = result.time;
+    fprintf(stderr, "%s\n",
+            std::format("{} {} {:.3f}ms {}", entry.program,
+                        entry.input.empty() ? "-" : entry.input, ms.count(),
+                        result.error.empty() ? "ok" : result.error)
+                .c_str());
+    if (!result.error.empty())
+      status = EXIT_FAILURE;
+  }
+  fflush(outstream);
+  return status;
+}
+
+/**
+ * The run SIGINT and SIGTERM suspend while run_resumable installs them.
+ */
+std::atomic<brainfk::suspend_t *> suspending = nullptr;
+
+void on_suspend(int) {
+  if (const auto suspend = suspending.load(std::memory_order_relaxed))
+    suspend->request();
+}
+
+/**
+ * Run program on tape, carrying on from the checkpoint --resume names if
+ * any. With --checkpoint, SIGINT, SIGTERM or --checkpoint-after back edges
+ * suspend the run into a checkpoint there instead of ending it; returns
+ * false if it did.
+ */
+bool run_resumable(const settings_t &settings, std::string_view program,
+                   const brainfk::tape_t &tape, brainfk::output_t &output,
+                   brainfk::input_t &input) {
+  auto &vm = *settings.machine;
+  const auto key = brainfk::checkpoint_t::key(program);
+
+  brainfk::position_t from;
+  if (settings.resume) {
+    const auto checkpoint = brainfk::checkpoint_t::load(*settings.resume);
+    if (checkpoint.program_key != key)
+      throw std::runtime_error{std::format(
+          "{} is a checkpoint of another program", *settings.resume)};
+    if (checkpoint.cell_bits != vm.cell_bits())
+      throw std::runtime_error{
+          std::format("{} is a checkpoint with {} bit cells",
+                      *settings.resume, checkpoint.cell_bits)};
+    checkpoint.restore(tape, brainfk::checkpoint_t::instructions(program));
+    input.skip(checkpoint.input);
+    from = checkpoint.position;
+  }
+
+  // a run that can't stop part way would ignore the signals, so rather than
+  // catch them for nothing the checkpoint is refused
+  auto compiled = vm.compile(program);
+  if (settings.checkpoint && !vm.can_suspend(compiled))
+    throw std::runtime_error{std::format(
+        "-m {} can't suspend this program for --checkpoint",
+        settings.machine_name)};
+
+  brainfk::suspend_t suspend{settings.checkpoint_after.value_or(
+      std::numeric_limits<std::uint64_t>::max())};
+  struct sigaction action {}, interrupt{}, terminate{};
+  action.sa_handler = on_suspend;
+  action.sa_flags = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  if (settings.checkpoint) {
+    suspending = &suspend;
+    ::sigaction(SIGINT, &action, &interrupt);
+    ::sigaction(SIGTERM, &action, &terminate);
+  }
+  const brainfk::guard restore{[&]() {
+    if (!settings.checkpoint)
+      return;
+    ::sigaction(SIGINT, &interrupt, nullptr);
+    ::sigaction(SIGTERM, &terminate, nullptr);
+    suspending = nullptr;
+  }};
+
+  std::optional<brainfk::position_t> position;
+  tape.run([&]() {
+    position = vm.execute(compiled, tape.data(), output, input, suspend, from);
+  });
+  if (!position)
+    return true;
+
+  brainfk::checkpoint_t checkpoint;
+  checkpoint.program_key = key;
+  checkpoint.cell_bits = vm.cell_bits();
+  checkpoint.position = *position;
+  checkpoint.input = input.consumed();
+  checkpoint.capture(tape);
+  checkpoint.save(*settings.checkpoint);
+  return false;
+}
+
 } // namespace
 
 int brainfk::repl_main(int argc, const char *argv[], brainfk::readline_t &rl) {
@@ -60,45 +418,107 @@ int brainfk::repl_main(int argc, const char *argv[], brainfk::readline_t &rl) {
 
   const auto settings = parse_cmdline(argc, argv);
 
+  if (settings.output && !settings.emit) {
+    fprintf(stderr, "-o needs --emit\n");
+    return EXIT_FAILURE;
+  }
+
   auto outstream = rl.outstream();
   auto instream = rl.instream();
 
-  llvm_machine_t vm;
-  std::string program;
+  auto &vm = *settings.machine;
+  vm.cache(settings.cache);
 
-  if (settings.script_name) {
-    std::unique_ptr<FILE, void (*)(FILE *)> infile{
-        fopen(settings.script_name->c_str(), "r"), [](FILE *f) {
-          if (f != nullptr)
-            fclose(f);
-        }};
+  // however ccbf finishes
+  const guard print_stats{[&]() {
+    if (settings.stats)
+      fprintf(stderr, "%s",
+              brainfk::stats_table(settings.stats->stats()).c_str());
+  }};
 
-    if (!infile)
+  if (settings.batch) {
+    try {
+      return batch_main(settings, outstream);
+    } catch (const std::exception &e) {
+      fprintf(stderr, "%s\n", e.what());
       return EXIT_FAILURE;
+    }
+  }
 
-    char buf[1 << 13];
+  if (settings.script_name) {
+    std::optional<source_t> source;
+    try {
+      source.emplace(*settings.script_name);
+    } catch (const std::exception &e) {
+      fprintf(stderr, "%s\n", e.what());
+      return EXIT_FAILURE;
+    }
 
-    for (;;) {
-      if (fgets(buf, sizeof(buf), infile.get()) == nullptr)
-        break;
-      program += buf;
+    if (settings.checkpoint_after && !settings.checkpoint) {
+      fprintf(stderr, "--checkpoint-after needs --checkpoint\n");
+      return EXIT_FAILURE;
     }
 
-    auto compiled = vm.compile(program);
+    if (settings.emit) {
+      if (!settings.output) {
+        fprintf(stderr, "--emit needs -o\n");
+        return EXIT_FAILURE;
+      }
+      try {
+        brainfk::emit(source->text(), *settings.emit, *settings.output,
+                      settings.llvm, settings.cell_bits);
+      } catch (const std::exception &e) {
+        fprintf(stderr, "%s\n", e.what());
+        return EXIT_FAILURE;
+      }
+      return EXIT_SUCCESS;
+    }
 
-    auto memory = std::make_unique<std::byte[]>(30'000);
+    try {
+      const tape_t tape{settings.tape_size, settings.tape_before,
+                        settings.cell_bits / 8,
+                        tape_t::reach(source->text())};
 
-    vm.execute(
-        compiled, memory.get(),
-        [&](std::byte c) { ::fputc(char(c), outstream); },
-        [&]() -> std::byte { return std::byte(::fgetc(instream)); });
+      fflush(outstream);
+      fd_output_t output{fileno(outstream)};
+      fd_input_t input{fileno(instream), settings.eof};
+      if (settings.profile) {
+        // the listing goes to the file named, the stacks alongside it
+        const auto counts = vm.profile(source->text(), tape, output, input);
+        const std::filesystem::path listing{*settings.profile};
+        write_file(listing, brainfk::profile_listing(source->text(), counts));
+        write_file(std::filesystem::path(listing) += ".folded",
+                   brainfk::profile_stacks(
+                       std::filesystem::path(*settings.script_name)
+                           .filename()
+                           .string(),
+                       source->text(), counts));
+      } else if (settings.checkpoint || settings.resume) {
+        if (!run_resumable(settings, source->text(), tape, output, input)) {
+          fprintf(stderr, "%s\n",
+                  std::format("suspended into {}", *settings.checkpoint)
+                      .c_str());
+          return EX_TEMPFAIL;
+        }
+      } else {
+        auto compiled = vm.compile(source->text());
+        tape.run(
+            [&]() { vm.execute(compiled, tape.data(), output, input); });
+      }
+    } catch (const std::exception &e) {
+      fprintf(stderr, "%s\n", e.what());
+      return EXIT_FAILURE;
+    }
 
-    fflush(outstream);
     return EXIT_SUCCESS;
   }
 
   assert(outstream);
 
+  std::string program;
+  // shared by the programs entered so input read ahead isn't lost
+  fd_input_t input{fileno(instream), settings.eof};
+
   try {
     while (auto line = adopt_c_ptr(rl.readline("ccbf> "))) {
       if (*line) {
@@ -111,18 +531,20 @@ int brainfk::repl_main(int argc, const char *argv[], brainfk::readline_t &rl) {
         if (program.empty())
           continue;
         auto compiled = vm.compile(program);
-        auto memory = std::make_unique<std::byte[]>(30'000);
-        vm.execute(
-            compiled, memory.get(),
-            [&](std::byte c) { ::fputc(char(c), outstream); },
-            [&]() -> std::byte { return std::byte(::fgetc(instream)); });
+        const tape_t tape{settings.tape_size, settings.tape_before,
+                          settings.cell_bits / 8, tape_t::reach(program)};
+        ::fflush(outstream);
+        fd_output_t output{fileno(outstream)};
+        tape.run(
+            [&]() { vm.execute(compiled, tape.data(), output, input); });
         ::fputc('\n', outstream);
         ::fflush(outstream);
         program.clear();
       }
     }
     return EXIT_SUCCESS;
-  } catch (const std::exception &) {
+  } catch (const std::exception &e) {
+    fprintf(stderr, "%s\n", e.what());
     return EXIT_FAILURE;
   }
 }
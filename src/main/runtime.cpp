@@ -0,0 +1,36 @@
+#include "runtime.hpp"
+#include "scan.hpp"
+
+void brainfk_flush(void *output) {
+  static_cast<brainfk::output_t *>(output)->flush();
+}
+
+void brainfk_write(void *output, const std::byte *bytes, std::size_t size) {
+  static_cast<brainfk::output_t *>(output)->put({bytes, size});
+}
+
+std::byte brainfk_underflow(void *input, std::byte current) {
+  return static_cast<brainfk::input_t *>(input)->underflow(current);
+}
+
+std::byte *brainfk_scan(std::byte *pointer, std::int32_t stride) {
+  return brainfk::scan(pointer, stride);
+}
+
+std::uint16_t brainfk_underflow16(void *input, std::uint16_t current) {
+  return static_cast<brainfk::input_t *>(input)->underflow(current);
+}
+
+std::uint32_t brainfk_underflow32(void *input, std::uint32_t current) {
+  return static_cast<brainfk::input_t *>(input)->underflow(current);
+}
+
+std::byte *brainfk_scan16(std::byte *pointer, std::int32_t stride) {
+  return reinterpret_cast<std::byte *>(
+      brainfk::scan(reinterpret_cast<std::uint16_t *>(pointer), stride));
+}
+
+std::byte *brainfk_scan32(std::byte *pointer, std::int32_t stride) {
+  return reinterpret_cast<std::byte *>(
+      brainfk::scan(reinterpret_cast<std::uint32_t *>(pointer), stride));
+}
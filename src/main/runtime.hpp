@@ -0,0 +1,55 @@
+#ifndef BRAINFK_RUNTIME_HPP
+#define BRAINFK_RUNTIME_HPP
+
+#include "io.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * The functions code generated by the llvm machine calls, by the (unmangled)
+ * names it declares them with. They're defined in the JIT for compiled
+ * programs and linked from the brainfk-runtime library into ahead of time
+ * compiled ones.
+ */
+extern "C" {
+
+void brainfk_flush(void *output);
+
+void brainfk_write(void *output, const std::byte *bytes, std::size_t size);
+
+std::byte brainfk_underflow(void *input, std::byte current);
+
+std::byte *brainfk_scan(std::byte *pointer, std::int32_t stride);
+
+/**
+ * The same for cells of 16 and 32 bits; the pointers are to the cells.
+ */
+std::uint16_t brainfk_underflow16(void *input, std::uint16_t current);
+
+std::uint32_t brainfk_underflow32(void *input, std::uint32_t current);
+
+std::byte *brainfk_scan16(std::byte *pointer, std::int32_t stride);
+
+std::byte *brainfk_scan32(std::byte *pointer, std::int32_t stride);
+
+/**
+ * The entry point of an ahead of time compiled program; output and input
+ * are the brainfk::output_t and brainfk::input_t whose buffers are passed.
+ * Returns the final tape pointer.
+ */
+std::byte *brainfk_main(std::byte *mem,
+                        brainfk::output_t::buffer_t *output_buffer,
+                        void *output, brainfk::input_t::buffer_t *input_buffer,
+                        void *input);
+
+/**
+ * Defined alongside brainfk_main for its tape: the width of its cells and
+ * the program's brainfk::tape_t::reach.
+ */
+extern const std::uint32_t brainfk_cell_bits;
+
+extern const std::uint64_t brainfk_reach;
+}
+
+#endif // BRAINFK_RUNTIME_HPP
@@ -0,0 +1,34 @@
+#include "runtime.hpp"
+#include "tape.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+
+#include <unistd.h>
+
+/**
+ * main for ahead of time compiled programs: run brainfk_main over a zeroed
+ * tape with buffered stdin and stdout, reading -1 at end of input as ccbf
+ * does by default. The tape is 30,000 cells of whichever width the program
+ * was compiled for, guarded as ccbf's are.
+ */
+int main() {
+  try {
+    const brainfk::tape_t tape{brainfk::tape_t::default_size, 0,
+                               brainfk_cell_bits / 8, brainfk_reach};
+    brainfk::fd_output_t output{STDOUT_FILENO};
+    brainfk::fd_input_t input{STDIN_FILENO,
+                              brainfk::input_t::eof_t::minus_one};
+    input.tie(&output);
+    tape.run([&]() {
+      brainfk_main(tape.data(), &output.buffer(), &output, &input.buffer(),
+                   &input);
+    });
+    output.flush();
+    return EXIT_SUCCESS;
+  } catch (const std::exception &e) {
+    std::fprintf(stderr, "%s\n", e.what());
+    return EXIT_FAILURE;
+  }
+}
@@ -0,0 +1,197 @@
+#include "scan.hpp"
+
+#include <bit>
+#include <cstdlib>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace {
+
+template <typename Cell> using scan_fn = Cell *(*)(Cell *, std::int32_t);
+
+template <typename Cell> Cell *scan_scalar(Cell *pointer, std::int32_t stride) {
+  while (*pointer)
+    pointer += stride;
+  return pointer;
+}
+
+#if defined(__x86_64__)
+
+/**
+ * Byte lanes of a block at a multiple of step bytes from pointer, for a
+ * power of two step that divides the block width.
+ */
+std::uint32_t lanes(const void *pointer, std::size_t step) {
+  static constexpr std::uint32_t patterns[] = {
+      0xffffffff, 0x55555555, 0x11111111, 0x01010101, 0x00010001, 0x00000001,
+  };
+  const auto phase = std::uintptr_t(pointer) & (step - 1);
+  return patterns[std::countr_zero(step)] << phase;
+}
+
+/**
+ * The mask of lanes at or after (forward) or at or before (backward) lane.
+ */
+std::uint32_t from(std::uint32_t lane, bool forward) {
+  return forward ? ~0u << lane : (2u << lane) - 1;
+}
+
+/**
+ * The aligned block of Width bytes containing pointer.
+ */
+template <std::size_t Width, typename Cell> std::byte *align(Cell *pointer) {
+  return reinterpret_cast<std::byte *>(std::uintptr_t(pointer) &
+                                       ~std::uintptr_t(Width - 1));
+}
+
+/**
+ * The index of the first (forward) or last (backward) lane set in mask.
+ */
+int lane(std::uint32_t mask, bool forward) {
+  return forward ? std::countr_zero(mask) : 31 - std::countl_zero(mask);
+}
+
+/**
+ * The mask of the bytes of the zero Cells in the 16 bytes at block.
+ */
+template <typename Cell> std::uint32_t zeros_sse2(const std::byte *block) {
+  const auto v = _mm_load_si128(reinterpret_cast<const __m128i *>(block));
+  const auto zero = _mm_setzero_si128();
+  if constexpr (sizeof(Cell) == 1)
+    return std::uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)));
+  else if constexpr (sizeof(Cell) == 2)
+    return std::uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi16(v, zero)));
+  else
+    return std::uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi32(v, zero)));
+}
+
+template <typename Cell>
+[[gnu::target("avx2")]] std::uint32_t zeros_avx2(const std::byte *block) {
+  const auto v = _mm256_load_si256(reinterpret_cast<const __m256i *>(block));
+  const auto zero = _mm256_setzero_si256();
+  if constexpr (sizeof(Cell) == 1)
+    return std::uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, zero)));
+  else if constexpr (sizeof(Cell) == 2)
+    return std::uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi16(v, zero)));
+  else
+    return std::uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi32(v, zero)));
+}
+
+/**
+ * The cell whose first byte is lane of block.
+ */
+template <typename Cell> Cell *at(std::byte *block, int lane) {
+  return reinterpret_cast<Cell *>(block + lane);
+}
+
+template <typename Cell> Cell *scan_sse2(Cell *pointer, std::int32_t stride) {
+  if (!*pointer)
+    return pointer;
+
+  // cells are aligned, so the pattern picks out each one's first byte
+  const auto step = std::size_t(std::abs(stride)) * sizeof(Cell);
+  if (!std::has_single_bit(step) || step > 16)
+    return scan_scalar(pointer, stride);
+
+  const bool forward = stride > 0;
+  const auto pattern = lanes(pointer, step);
+  const std::ptrdiff_t delta = forward ? 16 : -16;
+
+  auto block = align<16>(pointer);
+  auto mask = zeros_sse2<Cell>(block) & pattern &
+              from(std::uint32_t(reinterpret_cast<std::byte *>(pointer) -
+                                 block),
+                   forward);
+  while (!mask) {
+    block += delta;
+    mask = zeros_sse2<Cell>(block) & pattern;
+  }
+  return at<Cell>(block, lane(mask, forward));
+}
+
+/**
+ * Gather 8 cells at a time for strides that aren't a power of two; each
+ * gather is confined to the 4KiB chunk containing pointer so it never
+ * faults where the scalar loop wouldn't.
+ */
+template <typename Cell>
+[[gnu::target("avx2")]] Cell *scan_gather(Cell *pointer, std::int32_t stride) {
+  const auto index =
+      _mm256_mullo_epi32(_mm256_set1_epi32(stride * std::int32_t(sizeof(Cell))),
+                         _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+  const auto low = _mm256_set1_epi32(int(Cell(-1)));
+  const auto span = std::ptrdiff_t(7) * stride * std::ptrdiff_t(sizeof(Cell));
+  const auto first = span < 0 ? span : 0;
+  const auto last = (span < 0 ? 0 : span) + 3;
+
+  for (;;) {
+    const auto address = std::uintptr_t(pointer);
+    if (((address + first) >> 12) == ((address + last) >> 12)) {
+      const auto v = _mm256_i32gather_epi32(
+          reinterpret_cast<const int *>(pointer), index, 1);
+      const auto z = _mm256_cmpeq_epi32(_mm256_and_si256(v, low),
+                                        _mm256_setzero_si256());
+      if (const auto mask = _mm256_movemask_ps(_mm256_castsi256_ps(z)))
+        return pointer + std::countr_zero(std::uint32_t(mask)) * stride;
+      pointer += 8 * stride;
+    } else {
+      if (!*pointer)
+        return pointer;
+      pointer += stride;
+    }
+  }
+}
+
+template <typename Cell>
+[[gnu::target("avx2")]] Cell *scan_avx2(Cell *pointer, std::int32_t stride) {
+  if (!*pointer)
+    return pointer;
+
+  const auto step = std::size_t(std::abs(stride)) * sizeof(Cell);
+  if (step > 32)
+    return scan_scalar(pointer, stride);
+  if (!std::has_single_bit(step))
+    return scan_gather(pointer, stride);
+
+  const bool forward = stride > 0;
+  const auto pattern = lanes(pointer, step);
+  const std::ptrdiff_t delta = forward ? 32 : -32;
+
+  auto block = align<32>(pointer);
+  auto mask = zeros_avx2<Cell>(block) & pattern &
+              from(std::uint32_t(reinterpret_cast<std::byte *>(pointer) -
+                                 block),
+                   forward);
+  while (!mask) {
+    block += delta;
+    mask = zeros_avx2<Cell>(block) & pattern;
+  }
+  return at<Cell>(block, lane(mask, forward));
+}
+
+template <typename Cell> scan_fn<Cell> resolve() {
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return scan_avx2<Cell>;
+  return scan_sse2<Cell>;
+}
+
+#else
+
+template <typename Cell> scan_fn<Cell> resolve() { return scan_scalar<Cell>; }
+
+#endif
+
+} // namespace
+
+template <typename Cell>
+Cell *brainfk::scan(Cell *pointer, std::int32_t stride) {
+  static const scan_fn<Cell> impl = resolve<Cell>();
+  return impl(pointer, stride);
+}
+
+template std::uint8_t *brainfk::scan(std::uint8_t *, std::int32_t);
+template std::uint16_t *brainfk::scan(std::uint16_t *, std::int32_t);
+template std::uint32_t *brainfk::scan(std::uint32_t *, std::int32_t);
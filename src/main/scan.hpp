@@ -0,0 +1,28 @@
+#ifndef BRAINFK_SCAN_HPP
+#define BRAINFK_SCAN_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+namespace brainfk {
+
+/**
+ * Move pointer by stride cells until it points at a zero cell, i.e. the
+ * loop [>], [<<] etc, for cells of Cell: std::uint8_t, std::uint16_t or
+ * std::uint32_t, with pointer aligned to one. Uses SSE2/AVX2 (selected at
+ * runtime) where possible.
+ *
+ * Like memchr, the vector paths read whole aligned blocks around pointer so
+ * may touch bytes outside the tape, but never outside a page that the scalar
+ * loop would touch.
+ */
+template <typename Cell> Cell *scan(Cell *pointer, std::int32_t stride);
+
+inline std::byte *scan(std::byte *pointer, std::int32_t stride) {
+  return reinterpret_cast<std::byte *>(
+      scan(reinterpret_cast<std::uint8_t *>(pointer), stride));
+}
+
+} // namespace brainfk
+
+#endif // BRAINFK_SCAN_HPP
@@ -0,0 +1,51 @@
+#include "source.hpp"
+#include "ir.hpp"
+#include "util.hpp"
+
+#include <array>
+#include <cerrno>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+brainfk::source_t::source_t(const std::filesystem::path &path) {
+  const auto fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    throw std::system_error{errno, std::generic_category(), path.string()};
+  guard fd_guard{[fd]() { ::close(fd); }};
+  load(fd);
+}
+
+brainfk::source_t::source_t(int fd) { load(fd); }
+
+brainfk::source_t::~source_t() {
+  if (mapping_)
+    ::munmap(mapping_, length_);
+}
+
+void brainfk::source_t::load(int fd) {
+  struct stat st {};
+  posix(::fstat, fd, &st);
+
+  if (S_ISREG(st.st_mode) && st.st_size > 0) {
+    length_ = std::size_t(st.st_size);
+    const auto mapping =
+        ::mmap(nullptr, length_, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapping != MAP_FAILED) {
+      // parsed front to back, once
+      ::madvise(mapping, length_, MADV_SEQUENTIAL);
+      mapping_ = mapping;
+      text_ = {static_cast<const char *>(mapping_), length_};
+      return;
+    }
+    length_ = 0;
+  }
+
+  std::array<char, 1 << 16> chunk;
+  while (const auto n = posix(::read, fd, chunk.data(), chunk.size()))
+    ir::strip_comments({chunk.data(), std::size_t(n)}, stripped_);
+  text_ = stripped_;
+}
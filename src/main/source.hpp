@@ -0,0 +1,46 @@
+#ifndef BRAINFK_SOURCE_HPP
+#define BRAINFK_SOURCE_HPP
+
+#include <cstddef>
+#include <filesystem>
+#include <string>
+#include <string_view>
+
+namespace brainfk {
+
+/**
+ * A program's text as machines compile it, without copying a large file:
+ * a regular file is mapped, and anything else, e.g. a pipe, is read in
+ * large chunks keeping only the brainfk characters.
+ */
+class source_t {
+public:
+  /**
+   * Throws std::system_error if path can't be opened or read.
+   */
+  explicit source_t(const std::filesystem::path &path);
+
+  /**
+   * Read from fd, which stays open.
+   */
+  explicit source_t(int fd);
+
+  ~source_t();
+
+  source_t(const source_t &) = delete;
+  source_t &operator=(const source_t &) = delete;
+
+  std::string_view text() const { return text_; }
+
+private:
+  void load(int fd);
+
+  void *mapping_ = nullptr;
+  std::size_t length_ = 0;
+  std::string stripped_;
+  std::string_view text_;
+};
+
+} // namespace brainfk
+
+#endif // BRAINFK_SOURCE_HPP
@@ -0,0 +1,102 @@
+#include "stats_machine.hpp"
+
+#include <chrono>
+#include <format>
+#include <tuple>
+
+namespace {
+
+/**
+ * The calling thread's counters, opened on first use so threads that never
+ * run a stats machine don't pay for them.
+ */
+const brainfk::perf_counters_t &counters() {
+  thread_local const brainfk::perf_counters_t result;
+  return result;
+}
+
+std::string count(const std::optional<std::uint64_t> &count) {
+  return count ? std::format("{}", *count) : "-";
+}
+
+} // namespace
+
+brainfk::machine_stats_t brainfk::stats_machine_t::stats() const {
+  std::lock_guard lock{mutex_};
+  return stats_;
+}
+
+brainfk::machine_t::executable_ptr_t
+brainfk::stats_machine_t::compile_impl(std::string_view program) {
+  const auto before = counters().mark();
+  auto result = machine_->compile(program);
+  const auto counts = counters().since(before);
+
+  std::lock_guard lock{mutex_};
+  ++stats_.compiles;
+  stats_.compile += counts;
+  return result;
+}
+
+void brainfk::stats_machine_t::execute_impl(const executable_ptr_t &executable,
+                                            std::byte *mem, output_t &output,
+                                            input_t &input) {
+  // nothing here may need destroying if the tape abandons the run
+  const auto before = counters().mark();
+  machine_->execute(executable, mem, output, input);
+  const auto counts = counters().since(before);
+
+  std::lock_guard lock{mutex_};
+  ++stats_.executes;
+  stats_.execute += counts;
+}
+
+std::optional<brainfk::position_t> brainfk::stats_machine_t::suspendable_impl(
+    const executable_ptr_t &executable, std::byte *mem, output_t &output,
+    input_t &input, suspend_t &suspend, position_t from) {
+  // counted as an execute, however much of the program it runs
+  const auto before = counters().mark();
+  auto result = machine_->execute(executable, mem, output, input, suspend,
+                                  from);
+  const auto counts = counters().since(before);
+
+  std::lock_guard lock{mutex_};
+  ++stats_.executes;
+  stats_.execute += counts;
+  return result;
+}
+
+bool brainfk::stats_machine_t::can_suspend_impl(
+    const executable_ptr_t &executable) const {
+  return machine_->can_suspend(executable);
+}
+
+std::vector<std::uint64_t>
+brainfk::stats_machine_t::profile_impl(std::string_view program,
+                                       const tape_t &tape, output_t &output,
+                                       input_t &input) {
+  return machine_->profile(program, tape, output, input);
+}
+
+std::string brainfk::stats_table(const machine_stats_t &stats) {
+  auto result = std::format(
+      "{:<8} {:>6} {:>12} {:>14} {:>14} {:>5} {:>12} {:>12} {:>12}\n",
+      "phase", "calls", "ms", "cycles", "instructions", "ipc",
+      "branch-miss", "l1d-miss", "l1i-miss");
+  for (const auto &[phase, calls, counts] :
+       {std::tuple{"compile", stats.compiles, &stats.compile},
+        std::tuple{"execute", stats.executes, &stats.execute}}) {
+    const std::chrono::duration<double, std::milli> ms = counts->time;
+    const auto ipc = counts->cycles && counts->instructions && *counts->cycles
+                         ? std::format("{:.2f}",
+                                       double(*counts->instructions) /
+                                           double(*counts->cycles))
+                         : "-";
+    result += std::format(
+        "{:<8} {:>6} {:>12.3f} {:>14} {:>14} {:>5} {:>12} {:>12} {:>12}\n",
+        phase, calls, ms.count(), count(counts->cycles),
+        count(counts->instructions), ipc, count(counts->branch_misses),
+        count(counts->l1d_misses), count(counts->l1i_misses));
+  }
+  return result;
+}
@@ -0,0 +1,66 @@
+#ifndef BRAINFK_STATS_MACHINE_HPP
+#define BRAINFK_STATS_MACHINE_HPP
+
+#include "machine.hpp"
+#include "perf.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace brainfk {
+
+struct machine_stats_t {
+  std::uint64_t compiles = 0;
+  std::uint64_t executes = 0;
+  /**
+   * Summed over every call, whichever thread made it.
+   */
+  perf_counts_t compile{};
+  perf_counts_t execute{};
+};
+
+/**
+ * Passes everything on to machine, measuring each compile and execute with
+ * the calling thread's perf_counters_t. An execute abandoned by tape_t::run
+ * isn't counted. Profiling isn't measured at all, its counting would skew
+ * the numbers.
+ */
+class stats_machine_t : public machine_t {
+public:
+  explicit stats_machine_t(std::unique_ptr<machine_t> machine)
+      : machine_t(machine->cell_bits()), machine_(std::move(machine)) {}
+
+  machine_stats_t stats() const;
+
+  void cache(std::shared_ptr<const code_cache_t> cache) override {
+    machine_->cache(std::move(cache));
+  }
+
+private:
+  executable_ptr_t compile_impl(std::string_view) override;
+  void execute_impl(const executable_ptr_t &, std::byte *, output_t &,
+                    input_t &) override;
+  std::optional<position_t> suspendable_impl(const executable_ptr_t &,
+                                             std::byte *, output_t &,
+                                             input_t &, suspend_t &,
+                                             position_t) override;
+  bool can_suspend_impl(const executable_ptr_t &) const override;
+  std::vector<std::uint64_t> profile_impl(std::string_view, const tape_t &,
+                                          output_t &, input_t &) override;
+
+  std::unique_ptr<machine_t> machine_;
+  mutable std::mutex mutex_;
+  machine_stats_t stats_;
+};
+
+/**
+ * stats as a table, a row per phase with its calls, milliseconds, events
+ * and instructions per cycle; "-" for what wasn't counted.
+ */
+std::string stats_table(const machine_stats_t &stats);
+
+} // namespace brainfk
+
+#endif // BRAINFK_STATS_MACHINE_HPP
@@ -0,0 +1,154 @@
+#include "tape.hpp"
+
+#include <algorithm>
+#include <csetjmp>
+#include <csignal>
+#include <cstdint>
+#include <format>
+#include <mutex>
+#include <stdexcept>
+#include <system_error>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace {
+
+std::size_t round_up(std::size_t size) {
+  static const auto page = std::size_t(::sysconf(_SC_PAGESIZE));
+  return (size + page - 1) / page * page;
+}
+
+/**
+ * A tape_t::run in progress, found by the signal handler through current.
+ */
+struct run_t {
+  std::uintptr_t low;   // the whole mapping
+  std::uintptr_t high;
+  std::uintptr_t begin; // the cells
+  std::uintptr_t end;
+  std::uintptr_t data;
+  std::intptr_t cell_size;
+  sigjmp_buf env;
+  std::intptr_t cell;
+};
+
+thread_local run_t *current = nullptr;
+
+/**
+ * The SIGSEGV handler is installed while any run is in progress, on any
+ * thread, and previous restored after the last; sigaction is process wide.
+ */
+std::mutex mutex;
+std::size_t runs = 0;
+struct sigaction previous;
+
+void on_segv(int, siginfo_t *info, void *) {
+  const auto address = reinterpret_cast<std::uintptr_t>(info->si_addr);
+  if (const auto run = current; run && address >= run->low &&
+                                address < run->high &&
+                                (address < run->begin || address >= run->end)) {
+    // rounding down, a fault below data is in a negative cell
+    const auto offset = std::intptr_t(address - run->data);
+    run->cell = (offset - (offset < 0 ? run->cell_size - 1 : 0)) /
+                run->cell_size;
+    siglongjmp(run->env, 1);
+  }
+  // not a tape's; returning faults again under the previous action
+  ::sigaction(SIGSEGV, &previous, nullptr);
+}
+
+/**
+ * Engages the handler and publishes run for the lifetime of a tape_t::run.
+ */
+class engaged_t {
+public:
+  explicit engaged_t(run_t *run) : outer_(current) {
+    {
+      std::lock_guard lock{mutex};
+      if (runs++ == 0) {
+        struct sigaction action {};
+        action.sa_sigaction = on_segv;
+        action.sa_flags = SA_SIGINFO;
+        sigemptyset(&action.sa_mask);
+        ::sigaction(SIGSEGV, &action, &previous);
+      }
+    }
+    current = run;
+  }
+
+  ~engaged_t() {
+    current = outer_;
+    std::lock_guard lock{mutex};
+    if (--runs == 0)
+      ::sigaction(SIGSEGV, &previous, nullptr);
+  }
+
+  engaged_t(const engaged_t &) = delete;
+  engaged_t &operator=(const engaged_t &) = delete;
+
+private:
+  run_t *outer_;
+};
+
+} // namespace
+
+std::size_t brainfk::tape_t::reach(std::string_view program) {
+  // between two accesses a program makes its moves one after another, or
+  // loops forever touching nothing, and the accesses are at offsets either
+  // side of the pointer; the optimizer sums <s and >s into those, while
+  // evaluating a prefix sets cells and moves anywhere among the first
+  // default_size, however few <s and >s it took to get there
+  const auto steps = std::size_t(std::ranges::count_if(
+      program, [](char c) { return c == '<' || c == '>'; }));
+  return 3 * std::max(steps, default_size) + 1;
+}
+
+brainfk::tape_t::tape_t(std::size_t size, std::size_t before,
+                        std::size_t cell_size, std::size_t reach)
+    : cell_size_(cell_size) {
+  size = round_up(size * cell_size);
+  before = round_up(before * cell_size);
+  // no access can land beyond a guard
+  const auto guard =
+      round_up(std::clamp(reach, std::size_t(1), any_reach) * cell_size);
+  length_ = guard + before + size + guard;
+
+  // reserve everything inaccessible then open up the cells; neither needs
+  // swap until pages are written
+  const auto mapping = ::mmap(nullptr, length_, PROT_NONE,
+                              MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                              -1, 0);
+  if (mapping == MAP_FAILED)
+    throw std::system_error{errno, std::generic_category(), "mmap"};
+  mapping_ = static_cast<std::byte *>(mapping);
+  begin_ = mapping_ + guard;
+  end_ = begin_ + before + size;
+  data_ = begin_ + before;
+
+  if (::mprotect(begin_, std::size_t(end_ - begin_),
+                 PROT_READ | PROT_WRITE)) {
+    const auto error = errno;
+    ::munmap(mapping_, length_);
+    throw std::system_error{error, std::generic_category(), "mprotect"};
+  }
+}
+
+brainfk::tape_t::~tape_t() { ::munmap(mapping_, length_); }
+
+void brainfk::tape_t::run(const std::function<void()> &execute) const {
+  run_t run{std::uintptr_t(mapping_),
+            std::uintptr_t(mapping_ + length_),
+            std::uintptr_t(begin_),
+            std::uintptr_t(end_),
+            std::uintptr_t(data_),
+            std::intptr_t(cell_size_),
+            {},
+            0};
+  engaged_t engaged{&run};
+
+  if (sigsetjmp(run.env, 1))
+    throw std::runtime_error{std::format("tape overflow at cell {}", run.cell)};
+
+  execute();
+}
@@ -0,0 +1,73 @@
+#ifndef BRAINFK_TAPE_HPP
+#define BRAINFK_TAPE_HPP
+
+#include <cstddef>
+#include <functional>
+#include <span>
+#include <string_view>
+
+namespace brainfk {
+
+/**
+ * A zeroed tape in its own mapping, with size cells of cell_size bytes from
+ * data() on and before cells below it, each rounded up to whole pages. The
+ * kernel only backs the pages a program touches so a large tape costs
+ * nothing until it's used. Both ends are guarded by inaccessible regions
+ * wider than reach cells, so machines needn't check bounds.
+ */
+class tape_t {
+public:
+  static constexpr std::size_t default_size = 30'000;
+
+  /**
+   * How far past the last cell it touched any program's next access can
+   * be, a move and an offset of as many cells as an int32_t holds; guards
+   * this wide reserve tens of gigabytes, so pass reach(program) instead
+   * when there is one.
+   */
+  static constexpr std::size_t any_reach = std::size_t(1) << 33;
+
+  /**
+   * How far past the last cell it touched program's next access can be.
+   */
+  static std::size_t reach(std::string_view program);
+
+  explicit tape_t(std::size_t size = default_size, std::size_t before = 0,
+                  std::size_t cell_size = 1, std::size_t reach = any_reach);
+
+  ~tape_t();
+
+  tape_t(const tape_t &) = delete;
+  tape_t &operator=(const tape_t &) = delete;
+
+  std::byte *data() const { return data_; }
+
+  /**
+   * Every accessible byte; data() is somewhere inside.
+   */
+  std::span<std::byte> cells() const {
+    return {begin_, std::size_t(end_ - begin_)};
+  }
+
+  /**
+   * Call execute, which runs a program on this tape; if it touches a guard
+   * region it's abandoned and std::runtime_error is thrown naming the cell.
+   * Abandoning it skips destructors, so nothing between here and the code
+   * touching the tape may own anything needing one: execute should only
+   * call machine_t::execute with an output_t and input_t it doesn't own,
+   * whose frames own nothing on the way into the machines' code.
+   */
+  void run(const std::function<void()> &execute) const;
+
+private:
+  std::byte *mapping_;
+  std::size_t length_;
+  std::byte *begin_;
+  std::byte *end_;
+  std::byte *data_;
+  std::size_t cell_size_;
+};
+
+} // namespace brainfk
+
+#endif // BRAINFK_TAPE_HPP
@@ -0,0 +1,239 @@
+#include "tiered_machine.hpp"
+#include "bytecode.hpp"
+#include "ir.hpp"
+#include "scan.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <future>
+#include <iterator>
+#include <optional>
+#include <vector>
+
+namespace {
+
+using brainfk::bytecode::instruction_t;
+using brainfk::bytecode::op_code_t;
+
+/**
+ * A loop's entry and back edge count and, once it's hot, its native code.
+ * Runs of the same executable on several threads may race on count, which
+ * only delays tiering up.
+ */
+struct loop_t {
+  enum class state_t : std::uint8_t { cold, compiling, ready, failed };
+
+  // the indices of the loop's zjmp and njmp, and of its open and close nodes
+  std::size_t open;
+  std::size_t close;
+  std::atomic<std::uint32_t> count{};
+  // ready is stored with release once native is set
+  std::atomic<state_t> state{};
+  brainfk::machine_t::executable_ptr_t native;
+  std::future<void> pending;
+};
+
+struct executable_t : public brainfk::executable_t {
+  executable_t(brainfk::ir::program_t program,
+               std::shared_ptr<brainfk::llvm_machine_t> llvm,
+               std::uint32_t hot)
+      : program_(std::move(program)),
+        instructions_(brainfk::bytecode::lower(program_)),
+        llvm_(std::move(llvm)), hot_(hot) {
+    // number the loops; their ids go in their jumps' unused offsets
+    std::size_t loops = 0;
+    for (const auto &i : instructions_)
+      loops += i.op_code == op_code_t::zjmp;
+    loops_ = std::vector<loop_t>(loops);
+
+    std::int32_t id = 0;
+    for (std::size_t i = 0; i < instructions_.size(); ++i) {
+      auto &open = instructions_[i];
+      if (open.op_code != op_code_t::zjmp)
+        continue;
+      const auto close = i + std::size_t(open.operand);
+      open.offset = id;
+      instructions_[close].offset = id;
+      loops_[std::size_t(id)].open = i;
+      loops_[std::size_t(id)].close = close;
+      ++id;
+    }
+  }
+
+  ~executable_t() override {
+    // background compiles write into loops_
+    for (auto &loop : loops_)
+      if (loop.pending.valid())
+        loop.pending.wait();
+  }
+
+  /**
+   * Run on a tape of Cell, the width the llvm machine compiles loops for,
+   * from position from. With a suspend it's checked at each interpreted
+   * back edge, so a native loop always runs to its end.
+   */
+  template <typename Cell>
+  std::optional<brainfk::position_t>
+  run(std::byte *tape, brainfk::output_t &output, brainfk::input_t &input,
+      brainfk::suspend_t *suspend = nullptr, brainfk::position_t from = {}) {
+    // the native loops take and return the pointer as bytes
+    const auto resume = [&](const loop_t &loop, Cell *pointer) {
+      return reinterpret_cast<Cell *>(
+          llvm_->resume(loop.native, reinterpret_cast<std::byte *>(pointer),
+                        output, input));
+    };
+
+    const auto origin = reinterpret_cast<Cell *>(tape);
+    auto pointer_ = origin + from.cell;
+    const auto begin = instructions_.begin();
+    const auto pc = std::min(from.pc, instructions_.size());
+    for (auto i = begin + std::ptrdiff_t(pc), e = instructions_.end(); i != e;
+         ++i) {
+      switch (i->op_code) {
+      case op_code_t::padd:
+        std::advance(pointer_, i->operand);
+        break;
+      case op_code_t::dadd:
+        pointer_[i->offset] = Cell(pointer_[i->offset] + Cell(i->value));
+        break;
+      case op_code_t::zjmp:
+        if (!*pointer_) {
+          std::advance(i, i->operand);
+        } else if (auto &loop = loops_[std::size_t(i->offset)]; ready(loop)) {
+          pointer_ = resume(loop, pointer_);
+          i = begin + std::ptrdiff_t(loop.close);
+        } else {
+          count(loop);
+        }
+        break;
+      case op_code_t::njmp:
+        if (*pointer_) {
+          // the native loop tests the head again, so is entered either way
+          if (auto &loop = loops_[std::size_t(i->offset)]; ready(loop)) {
+            pointer_ = resume(loop, pointer_);
+          } else {
+            count(loop);
+            std::advance(i, i->operand);
+            // stop with the loop's body next
+            if (suspend && suspend->due())
+              return brainfk::position_t{std::size_t(i - begin) + 1,
+                                         pointer_ - origin};
+          }
+        }
+        break;
+      case op_code_t::putc:
+        output.put(std::byte(pointer_[i->offset]));
+        break;
+      case op_code_t::puts:
+        for (std::int32_t j = 0; j < i->operand; ++j)
+          output.put(brainfk::ir::written(i->value, std::size_t(j)));
+        break;
+      case op_code_t::getc:
+        pointer_[i->offset] = input.get(pointer_[i->offset]);
+        break;
+      case op_code_t::set:
+        pointer_[i->offset] = Cell(i->value);
+        break;
+      case op_code_t::madd:
+        if (const auto factor = unsigned(pointer_[i->operand]))
+          pointer_[i->offset] =
+              Cell(pointer_[i->offset] + factor * unsigned(i->value));
+        break;
+      case op_code_t::scan:
+        pointer_ = brainfk::scan(pointer_, i->operand);
+        break;
+      case op_code_t::halt:
+        return std::nullopt;
+      }
+    }
+    return std::nullopt;
+  }
+
+private:
+  static bool ready(const loop_t &loop) {
+    return loop.state.load(std::memory_order_acquire) ==
+           loop_t::state_t::ready;
+  }
+
+  /**
+   * Count an entry or back edge, compiling the loop in the background when
+   * it's hot.
+   */
+  void count(loop_t &loop) {
+    if (loop.state.load(std::memory_order_relaxed) != loop_t::state_t::cold)
+      return;
+    // a plain load and store rather than a locked increment
+    const auto count = loop.count.load(std::memory_order_relaxed) + 1;
+    loop.count.store(count, std::memory_order_relaxed);
+    if (count != hot_)
+      return;
+
+    auto cold = loop_t::state_t::cold;
+    if (!loop.state.compare_exchange_strong(cold, loop_t::state_t::compiling,
+                                            std::memory_order_relaxed))
+      return;
+
+    const auto compile = [this, &loop]() {
+      try {
+        loop.native = llvm_->compile(brainfk::ir::program_t(
+            program_.begin() + std::ptrdiff_t(loop.open),
+            program_.begin() + std::ptrdiff_t(loop.close) + 1));
+        loop.state.store(loop_t::state_t::ready, std::memory_order_release);
+      } catch (const std::exception &) {
+        // the loop stays interpreted
+        loop.state.store(loop_t::state_t::failed, std::memory_order_relaxed);
+      }
+    };
+    try {
+      loop.pending = std::async(std::launch::async, compile);
+    } catch (const std::exception &) {
+      loop.state.store(loop_t::state_t::failed, std::memory_order_relaxed);
+    }
+  }
+
+  brainfk::ir::program_t program_;
+  std::vector<instruction_t> instructions_;
+  std::vector<loop_t> loops_;
+  std::shared_ptr<brainfk::llvm_machine_t> llvm_;
+  std::uint32_t hot_;
+};
+
+} // namespace
+
+brainfk::tiered_machine_t::tiered_machine_t(llvm_options_t llvm,
+                                            std::uint32_t hot,
+                                            unsigned cell_bits)
+    : machine_t(cell_bits),
+      llvm_(std::make_shared<llvm_machine_t>(std::move(llvm), cell_bits)),
+      hot_(hot) {}
+
+void brainfk::tiered_machine_t::cache(
+    std::shared_ptr<const code_cache_t> cache) {
+  llvm_->cache(std::move(cache));
+}
+
+brainfk::machine_t::executable_ptr_t
+brainfk::tiered_machine_t::compile_impl(std::string_view program) {
+  return std::make_unique<::executable_t>(
+      ir::evaluate(ir::compile(program)), llvm_, hot_);
+}
+
+void brainfk::tiered_machine_t::execute_impl(const executable_ptr_t &exe_,
+                                             std::byte *mem, output_t &output,
+                                             input_t &input) {
+  auto &exe = *dynamic_cast<::executable_t *>(exe_.get());
+  with_cell(cell_bits(), [&]<typename Cell>(std::type_identity<Cell>) {
+    exe.run<Cell>(mem, output, input);
+  });
+}
+
+std::optional<brainfk::position_t> brainfk::tiered_machine_t::suspendable_impl(
+    const executable_ptr_t &exe_, std::byte *mem, output_t &output,
+    input_t &input, suspend_t &suspend, position_t from) {
+  auto &exe = *dynamic_cast<::executable_t *>(exe_.get());
+  return with_cell(cell_bits(), [&]<typename Cell>(std::type_identity<Cell>) {
+    return exe.run<Cell>(mem, output, input, &suspend, from);
+  });
+}
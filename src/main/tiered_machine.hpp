@@ -0,0 +1,51 @@
+#ifndef BRAINFK_TIERED_MACHINE_HPP
+#define BRAINFK_TIERED_MACHINE_HPP
+
+#include "llvm_machine.hpp"
+#include "machine.hpp"
+
+#include <cstdint>
+#include <memory>
+
+namespace brainfk {
+
+/**
+ * Starts interpreting a program's bytecode straight away, counting each
+ * loop's entries and back edges. Once a loop has taken hot of them (high
+ * enough that only a few loops are ever compiled) its ir is compiled by
+ * an llvm machine on a background thread, and the next time the interpreter
+ * reaches the loop's head or back edge it calls the native loop instead;
+ * both run on the same tape so nothing else has to change hands.
+ */
+class tiered_machine_t : public machine_t {
+public:
+  static constexpr std::uint32_t default_hot = 1 << 16;
+
+  explicit tiered_machine_t(llvm_options_t llvm = {},
+                            std::uint32_t hot = default_hot,
+                            unsigned cell_bits = 8);
+
+  /**
+   * Only the compiled loops are cached, by the llvm machine.
+   */
+  void cache(std::shared_ptr<const code_cache_t> cache) override;
+
+private:
+  executable_ptr_t compile_impl(std::string_view) override;
+  void execute_impl(const executable_ptr_t &, std::byte *, output_t &,
+                    input_t &) override;
+  std::optional<position_t> suspendable_impl(const executable_ptr_t &,
+                                             std::byte *, output_t &,
+                                             input_t &, suspend_t &,
+                                             position_t) override;
+  bool can_suspend_impl(const executable_ptr_t &) const override {
+    return true;
+  }
+
+  std::shared_ptr<llvm_machine_t> llvm_;
+  std::uint32_t hot_;
+};
+
+} // namespace brainfk
+
+#endif // BRAINFK_TIERED_MACHINE_HPP
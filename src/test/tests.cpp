@@ -1,17 +1,35 @@
 #include <catch2/catch_all.hpp>
 #include <fakeit.hpp>
 
+#include "auto_machine.hpp"
+#include "batch.hpp"
+#include "bytecode.hpp"
+#include "cache.hpp"
+#include "checkpoint.hpp"
+#include "ir.hpp"
+#include "machines.hpp"
+#include "profile.hpp"
 #include "repl.hpp"
+#include "scan.hpp"
+#include "source.hpp"
+#include "stats_machine.hpp"
+#include "tape.hpp"
 #include "util.hpp"
 
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
 #include <filesystem>
+#include <format>
 #include <fstream>
+#include <optional>
 #include <random>
 #include <vector>
 
 #include <fcntl.h>
 #include <handrolled_machine.hpp>
 #include <llvm_machine.hpp>
+#include <tiered_machine.hpp>
 #include <unistd.h>
 
 namespace {
@@ -46,6 +64,17 @@ std::array<int, 2> make_pipe() {
   return result;
 }
 
+/**
+ * Make a fresh directory under the system temporary directory.
+ */
+std::filesystem::path make_temp_dir() {
+  auto pattern =
+      (std::filesystem::temp_directory_path() / "brainfk-XXXXXX").string();
+  if (mkdtemp(pattern.data()) == nullptr)
+    throw std::system_error(errno, std::system_category());
+  return pattern;
+}
+
 /**
  * Make a FILE stream from a file descriptor.
  */
@@ -136,6 +165,36 @@ struct handrolled_fixture_t : machine_fixture_t {
   }
 };
 
+/**
+ * Records each buffer it's asked to write.
+ */
+struct recording_output_t : brainfk::output_t {
+  recording_output_t() { storage(storage_); }
+
+  void write(std::span<const std::byte> bytes) override {
+    writes_.emplace_back(reinterpret_cast<const char *>(bytes.data()),
+                         bytes.size());
+  }
+
+  std::array<std::byte, 4> storage_;
+  std::vector<std::string> writes_;
+};
+
+struct threaded_fixture_t : machine_fixture_t {
+  threaded_fixture_t() {
+    machine_ = std::make_unique<brainfk::handrolled_machine_t>(
+        brainfk::handrolled_machine_t::dispatch_t::threaded);
+  }
+};
+
+struct tiered_fixture_t : machine_fixture_t {
+  // every loop is compiled once it has looped
+  tiered_fixture_t() {
+    machine_ = std::make_unique<brainfk::tiered_machine_t>(
+        brainfk::llvm_options_t{}, 1);
+  }
+};
+
 } // namespace
 
 TEST_CASE_METHOD(fixture_t, "repl_main executes a script and exits on quit",
@@ -182,6 +241,29 @@ TEST_CASE_METHOD(fixture_t, "repl executes a file provided on the command line",
   CHECK(history_.empty());
 }
 
+TEST_CASE("sources map files and strip comments from pipes", "[source]") {
+  std::mt19937 prng{Catch::rngSeed()};
+  auto [fpath, fstream] = make_temp_file(prng);
+  brainfk::guard fguard{[&]() {
+    fstream.close();
+    std::filesystem::remove(fpath);
+  }};
+  const std::string_view script = "a loop: +[-] and output .\n";
+  fstream << script;
+  fstream.close();
+
+  CHECK(brainfk::source_t{fpath}.text() == script);
+  CHECK_THROWS_AS(brainfk::source_t{fpath / "missing"}, std::system_error);
+
+  std::array<int, 2> pipe{};
+  brainfk::posix(::pipe, pipe.data());
+  brainfk::guard pipe_guard{[&]() { close(pipe[0]); }};
+  REQUIRE(::write(pipe[1], script.data(), script.size()) ==
+          ssize_t(script.size()));
+  close(pipe[1]);
+  CHECK(brainfk::source_t{pipe[0]}.text() == "+[-].");
+}
+
 TEST_CASE_METHOD(handrolled_fixture_t, "vm can execute the cc test script",
                  "[brainfk][vm]") {
   std::string result;
@@ -251,6 +333,101 @@ TEST_CASE_METHOD(handrolled_fixture_t, "zjmp instruction skips a block",
   CHECK(memory_[0] == std::byte(1));
 }
 
+TEST_CASE_METHOD(handrolled_fixture_t, "handrolled wide offsets and jumps",
+                 "[brainfk][vm][compile]") {
+  // offsets past 127 cells and a loop body past 127 bytes need wide forms
+  std::string body;
+  for (int i = 0; i < 100; ++i)
+    body += ">+<.";
+  exec(std::format("+++[{}{}+{}-]>[-]", body, std::string(201, '>'),
+                   std::string(201, '<')));
+  CHECK(output_.size() == 300);
+  CHECK(memory_[0] == std::byte(0));
+  CHECK(memory_[1] == std::byte(0));
+  CHECK(memory_[201] == std::byte(3));
+
+  // a dadd, a dadd fused with a padd, and the halt
+  const auto narrow = brainfk::bytecode::lower(brainfk::ir::compile("+>+"));
+  CHECK(brainfk::bytecode::compact::encode(narrow).size() == 8);
+}
+
+TEST_CASE("bytecode profiles op runs and fuses them", "[bytecode]") {
+  using brainfk::bytecode::op_code_t;
+
+  const auto instructions =
+      brainfk::bytecode::lower(brainfk::ir::compile("+>+"));
+  auto memory = std::make_unique<std::byte[]>(16);
+  brainfk::putc_output_t output{[](std::byte) {}};
+  brainfk::memory_input_t input{{}, brainfk::input_t::eof_t::zero};
+  std::vector<std::uint64_t> hits(instructions.size());
+  brainfk::bytecode::sequence_counts_t counts{};
+  brainfk::bytecode::profile(instructions, memory.get(), output, input, hits,
+                             counts);
+  CHECK(hits == std::vector<std::uint64_t>{1, 1, 1});
+  const auto count = [&](op_code_t first, op_code_t second,
+                         op_code_t third = op_code_t::halt) {
+    return counts[std::size_t(first)][std::size_t(second)]
+                 [std::size_t(third)];
+  };
+  CHECK(count(op_code_t::dadd, op_code_t::dadd) == 1);
+  CHECK(count(op_code_t::dadd, op_code_t::padd) == 1);
+  CHECK(count(op_code_t::dadd, op_code_t::dadd, op_code_t::padd) == 1);
+  CHECK(count(op_code_t::padd, op_code_t::dadd) == 0);
+  CHECK(memory[0] == std::byte(1));
+  CHECK(memory[1] == std::byte(1));
+
+  // one op byte for both, then the madd's three fields and the set's two
+  const brainfk::bytecode::instruction_t pair[] = {
+      {op_code_t::madd, 1, 1, 0}, {op_code_t::set, 0, 0, 0}};
+  const auto code = brainfk::bytecode::compact::encode(pair);
+  CHECK(code.size() == 7);
+  CHECK(std::uint8_t(code[0]) == brainfk::bytecode::compact::fused);
+
+  // the whole triple fuses rather than its leading pair, then the padd's
+  // operand
+  const brainfk::bytecode::instruction_t triple[] = {
+      {op_code_t::madd, 1, 1, 0},
+      {op_code_t::set, 0, 0, 0},
+      {op_code_t::padd, 0, 0, 1}};
+  const auto fused = brainfk::bytecode::compact::encode(triple);
+  CHECK(fused.size() == 8);
+  CHECK(std::uint8_t(fused[0]) == brainfk::bytecode::compact::fused + 8);
+}
+
+TEST_CASE("bytecode decodes only what its program could run",
+          "[bytecode]") {
+  using brainfk::bytecode::op_code_t;
+
+  const std::string_view program = "+[->>+<<]>>.";
+  const auto reach = brainfk::tape_t::reach(program);
+  const auto instructions =
+      brainfk::bytecode::lower(brainfk::ir::compile(program));
+  auto bytes = brainfk::bytecode::encode(instructions);
+  // the padding after each op code is zeroed
+  using instruction_t = brainfk::bytecode::instruction_t;
+  for (std::size_t i = 0; i < instructions.size(); ++i) {
+    const auto at = bytes.begin() + std::ptrdiff_t(i * sizeof(instruction_t));
+    CHECK(std::all_of(at + 1, at + offsetof(instruction_t, value),
+                      [](std::byte b) { return b == std::byte(0); }));
+  }
+  const auto decoded = brainfk::bytecode::decode(bytes, reach);
+  REQUIRE(decoded);
+  CHECK(brainfk::bytecode::encode(*decoded) == bytes);
+
+  // offsets, operands and moves past what the program could reach
+  const auto corrupt = [&](instruction_t instruction) {
+    auto copy = instructions;
+    copy.insert(copy.begin(), instruction);
+    return brainfk::bytecode::decode(brainfk::bytecode::encode(copy), reach);
+  };
+  CHECK(corrupt({op_code_t::dadd, 1, 1, 0}));
+  CHECK(!corrupt({op_code_t::dadd, 1, 1 << 30, 0}));
+  CHECK(!corrupt({op_code_t::madd, 1, 1, -(1 << 30)}));
+  CHECK(!corrupt({op_code_t::scan, 0, 0, 1 << 30}));
+  CHECK(!corrupt({op_code_t::padd, 0, 0, std::int32_t(reach)}));
+  CHECK(!corrupt({op_code_t::halt, 0, 0, 0}));
+}
+
 TEST_CASE_METHOD(llvm_fixture_t, "llvm +") {
   exec("+");
   CHECK(memory_[0] == std::byte(1));
@@ -344,3 +521,1006 @@ TEST_CASE_METHOD(handrolled_fixture_t, "handrolled ,.") {
   CHECK(memory_[0] == std::byte('B'));
   CHECK(output_ == "B");
 }
+
+TEST_CASE_METHOD(threaded_fixture_t, "threaded cc script") {
+  exec(R"xx(This is a test Brainf*ck script written
+    for Coding Challenges!
+    ++++++++++[>+>+++>+++++++>++++++++++<<<
+    <-]>>>++.>+.+++++++..+++.<<++++++++++++
+    ++.------------.>-----.>.-----------.++
+    +++.+++++.-------.<<.>.>+.-------.+++++
+    ++++++..-------.+++++++++.-------.--.++
+    ++++++++++++. What does it do?)xx");
+  CHECK(output_ == "Hello, Coding Challenges");
+}
+
+TEST_CASE_METHOD(threaded_fixture_t, "threaded input and output") {
+  input_ = "hello.";
+  exec("+[,.----------------------------------------------]");
+  CHECK(output_ == "hello.");
+}
+
+TEST_CASE_METHOD(threaded_fixture_t, "threaded zero and skip") {
+  exec("+>++>+++<<[-]>[-]>[-]>[++>]+");
+  CHECK(memory_[0] == std::byte(0));
+  CHECK(memory_[1] == std::byte(0));
+  CHECK(memory_[2] == std::byte(0));
+  CHECK(memory_[3] == std::byte(1));
+}
+
+TEST_CASE_METHOD(threaded_fixture_t, "threaded empty program") {
+  exec("");
+  CHECK(memory_[0] == std::byte(0));
+}
+
+TEST_CASE_METHOD(tiered_fixture_t, "tiered cc script") {
+  exec(R"xx(This is a test Brainf*ck script written
+    for Coding Challenges!
+    ++++++++++[>+>+++>+++++++>++++++++++<<<
+    <-]>>>++.>+.+++++++..+++.<<++++++++++++
+    ++.------------.>-----.>.-----------.++
+    +++.+++++.-------.<<.>.>+.-------.+++++
+    ++++++..-------.+++++++++.-------.--.++
+    ++++++++++++. What does it do?)xx");
+  CHECK(output_ == "Hello, Coding Challenges");
+}
+
+TEST_CASE_METHOD(tiered_fixture_t,
+                 "tiered machine switches to native code mid loop") {
+  // long enough that the native loops are ready well before the end; each
+  // must pick up the tape, pointer and output where the interpreter left off
+  const auto program = GENERATE(as<std::string_view>{},
+                                "-[>-[>-[>+[-]<-]<-]<-]>>>+.",
+                                "-[>+++[>+.<-]<-]",
+                                "-[>-[-[->+<]>[-<+>]<]<-]",
+                                "-[>,[>+<-]>.<<-]");
+  input_ = std::string(256, 'x');
+  exec(program);
+
+  brainfk::handrolled_machine_t reference;
+  auto memory = std::make_unique<std::byte[]>(30'000);
+  std::string output;
+  auto input = std::string(256, 'x');
+  reference.execute(
+      reference.compile(program), memory.get(),
+      [&](std::byte c) { output += char(c); },
+      [&]() {
+        auto result = input[0];
+        input = input.substr(1);
+        return std::byte(result);
+      });
+  CHECK(output_ == output);
+  CHECK(std::equal(memory_.get(), memory_.get() + 30'000, memory.get()));
+}
+
+TEST_CASE("auto machine only compiles programs that loop a lot", "[auto]") {
+  using brainfk::auto_machine_t;
+  using brainfk::ir::compile;
+  CHECK(auto_machine_t::choose(compile("")) == "threaded");
+  CHECK(auto_machine_t::choose(compile(
+            "++++++++++[>+>+++>+++++++>++++++++++<<<<-]>>>++.>+.")) ==
+        "threaded");
+  CHECK(auto_machine_t::choose(
+            compile("+[>+[>+[>+[>+[>+[>+[-]<-]<-]<-]<-]<-]<-]")) == "llvm");
+}
+
+TEST_CASE("ir parses runs and skips comments a block at a time", "[ir]") {
+  using brainfk::ir::op_t;
+
+  // a byte at a time
+  const auto reference = [](std::string_view source) {
+    brainfk::ir::program_t result;
+    for (auto c : source) {
+      const auto op = c == '+' || c == '-'   ? op_t::add
+                      : c == '>' || c == '<' ? op_t::move
+                      : c == '.'             ? op_t::put
+                      : c == ','             ? op_t::get
+                      : c == '['             ? op_t::open
+                      : c == ']'             ? op_t::close
+                                             : std::optional<op_t>{};
+      if (!op)
+        continue;
+      const auto value = c == '+' || c == '>'   ? 1
+                         : c == '-' || c == '<' ? -1
+                                                : 0;
+      if (value && !result.empty() && result.back().op == *op)
+        result.back().value += value;
+      else
+        result.push_back({*op, 0, value});
+    }
+    return result;
+  };
+
+  std::mt19937 prng{Catch::rngSeed()};
+  std::uniform_int_distribution<std::size_t> lengths{1, 40};
+  std::uniform_int_distribution<std::size_t> kinds{0, 11};
+  for (int i = 0; i < 100; ++i) {
+    // runs either side of the 16 byte blocks, between comments
+    std::string source;
+    std::size_t depth = 0;
+    while (source.size() < 1'000) {
+      const auto kind = kinds(prng);
+      if (kind < 4) {
+        source.append(lengths(prng), "+-<>"[kind]);
+      } else if (kind < 6) {
+        source += ".,"[kind - 4];
+      } else if (kind == 6) {
+        source += '[';
+        ++depth;
+      } else if (kind == 7 && depth) {
+        source += ']';
+        --depth;
+      } else {
+        source.append(lengths(prng), kind == 8 ? '\n' : 'x');
+      }
+    }
+    source.append(depth, ']');
+
+    CHECK(brainfk::ir::parse(source) == reference(source));
+  }
+}
+
+TEST_CASE("ir folds moves into offsets", "[ir]") {
+  using brainfk::ir::op_t;
+  CHECK(brainfk::ir::compile("+>+>+<<") ==
+        brainfk::ir::program_t{{op_t::add, 0, 1},
+                               {op_t::add, 1, 1},
+                               {op_t::add, 2, 1}});
+  CHECK(brainfk::ir::compile("+>+.>") ==
+        brainfk::ir::program_t{{op_t::add, 0, 1},
+                               {op_t::add, 1, 1},
+                               {op_t::put, 1},
+                               {op_t::move, 0, 2}});
+}
+
+TEST_CASE("ir replaces multiply and clear loops", "[ir]") {
+  using brainfk::ir::op_t;
+  CHECK(brainfk::ir::compile("+[->+>++<<]") ==
+        brainfk::ir::program_t{{op_t::add, 0, 1},
+                               {op_t::mul, 1, 1, 0},
+                               {op_t::mul, 2, 2, 0},
+                               {op_t::set, 0, 0}});
+  CHECK(brainfk::ir::compile("+[+>-<]") ==
+        brainfk::ir::program_t{{op_t::add, 0, 1},
+                               {op_t::mul, 1, 1, 0},
+                               {op_t::set, 0, 0}});
+  // clear and set fuse; the move to the last cell stays at the end
+  CHECK(brainfk::ir::compile("+>[-]+++") ==
+        brainfk::ir::program_t{{op_t::add, 0, 1},
+                               {op_t::set, 1, 3},
+                               {op_t::move, 0, 1}});
+}
+
+TEST_CASE("ir replaces scan loops", "[ir]") {
+  using brainfk::ir::op_t;
+  CHECK(brainfk::ir::compile("+[>]+[<<]") ==
+        brainfk::ir::program_t{{op_t::add, 0, 1},
+                               {op_t::scan, 0, 1},
+                               {op_t::add, 0, 1},
+                               {op_t::scan, 0, -2}});
+}
+
+TEST_CASE("ir drops loops at program start", "[ir]") {
+  using brainfk::ir::op_t;
+  CHECK(brainfk::ir::compile("[a comment, with. code[]]>[>]+") ==
+        brainfk::ir::program_t{{op_t::add, 1, 1}, {op_t::move, 0, 1}});
+}
+
+TEST_CASE("ir drops loops and sets on known cells", "[ir]") {
+  using brainfk::ir::op_t;
+  // a loop straight after a clear of its cell
+  CHECK(brainfk::ir::compile(",[-][.]") ==
+        brainfk::ir::program_t{{op_t::get}, {op_t::set, 0, 0}});
+  // the loop doesn't write the cleared cell, so it's still zero after
+  CHECK(brainfk::ir::compile(">,[-]<,[.,]>[-]") ==
+        brainfk::ir::program_t{{op_t::get, 1},
+                               {op_t::set, 1, 0},
+                               {op_t::get},
+                               {op_t::open},
+                               {op_t::put},
+                               {op_t::get},
+                               {op_t::close},
+                               {op_t::move, 0, 1}});
+}
+
+TEST_CASE("ir assumes programs start on a zeroed tape", "[ir]") {
+  using brainfk::ir::op_t;
+  // a loop on a cell nothing has written can't run
+  CHECK(brainfk::ir::compile(">[.]") ==
+        brainfk::ir::program_t{{op_t::move, 0, 1}});
+  // but its clear is kept, so a program that clears its cells before using
+  // them still runs on a reused tape
+  CHECK(brainfk::ir::compile(">[-]") ==
+        brainfk::ir::program_t{{op_t::set, 1, 0}, {op_t::move, 0, 1}});
+}
+
+TEST_CASE("ir marks loop tests with a known outcome", "[ir]") {
+  using brainfk::ir::op_t;
+  // entered on a non-zero cell
+  CHECK(brainfk::ir::compile("+[>+<,]") ==
+        brainfk::ir::program_t{{op_t::add, 0, 1},
+                               {op_t::open, 0, 1},
+                               {op_t::add, 1, 1},
+                               {op_t::get},
+                               {op_t::close}});
+  // left on a zero cell
+  CHECK(brainfk::ir::compile(",[>+<[-]]") ==
+        brainfk::ir::program_t{{op_t::get},
+                               {op_t::open},
+                               {op_t::add, 1, 1},
+                               {op_t::set, 0, 0},
+                               {op_t::close, 0, 1}});
+  // both, so it runs once
+  CHECK(brainfk::ir::compile("+[[-]>+<]") ==
+        brainfk::ir::program_t{{op_t::set, 0, 0}, {op_t::add, 1, 1}});
+}
+
+TEST_CASE("ir evaluates the prefix that needs no input", "[ir]") {
+  using brainfk::ir::op_t;
+  const auto evaluate = [](std::string_view source, auto... steps) {
+    return brainfk::ir::evaluate(brainfk::ir::compile(source), steps...);
+  };
+  // all of it, leaving the output and the tape
+  CHECK(evaluate("++++++++[>++++++++<-]>+.+.") ==
+        brainfk::ir::program_t{{op_t::write, 0, 'A' | 'B' << 8, 2},
+                               {op_t::set, 0, 0},
+                               {op_t::set, 1, 'B'},
+                               {op_t::move, 0, 1}});
+  // up to the first input
+  CHECK(evaluate("+++[>++<-],[.,]") ==
+        brainfk::ir::program_t{{op_t::set, 0, 0},
+                               {op_t::set, 1, 6},
+                               {op_t::get},
+                               {op_t::open},
+                               {op_t::put},
+                               {op_t::get},
+                               {op_t::close}});
+  // up to a test of 256, which is zero only in a byte
+  CHECK(evaluate("++++++++[>++++++++<-]>[<++++>-]<[.]") ==
+        brainfk::ir::program_t{{op_t::set, 0, 256},
+                               {op_t::set, 1, 0},
+                               {op_t::open},
+                               {op_t::put},
+                               {op_t::close}});
+  // up to the loop that runs out of steps
+  CHECK(evaluate("+[]", 100) ==
+        brainfk::ir::program_t{
+            {op_t::set, 0, 1}, {op_t::open, 0, 1}, {op_t::close}});
+}
+
+TEST_CASE_METHOD(llvm_fixture_t, "llvm compiles long constant output fast",
+                 "[ir]") {
+  // 7,000 bytes evaluated at compile time: generating a node per byte took
+  // minutes, a write per few bytes as one constant milliseconds
+  const auto program = std::format(
+      "++++++++[>++++++++<-]>+>++++++++++[>++++++++++[>{}[<<<.>>>-]<-]<-]",
+      std::string(70, '+'));
+  CHECK(brainfk::ir::evaluate(brainfk::ir::compile(program)).size() <
+        7'000 / brainfk::ir::max_written + 10);
+
+  const auto start = std::chrono::steady_clock::now();
+  exec(program);
+  CHECK(std::chrono::steady_clock::now() - start < std::chrono::seconds{10});
+  CHECK(output_ == std::string(7'000, 'A'));
+}
+
+TEST_CASE_METHOD(handrolled_fixture_t, "handrolled multiply loop") {
+  exec("+++[->++>+++<<]>>>+++++[-<<<+>>>]");
+  CHECK(memory_[0] == std::byte(5));
+  CHECK(memory_[1] == std::byte(6));
+  CHECK(memory_[2] == std::byte(9));
+  CHECK(memory_[3] == std::byte(0));
+}
+
+TEST_CASE_METHOD(llvm_fixture_t, "llvm multiply loop") {
+  exec("+++[->++>+++<<]>>>+++++[-<<<+>>>]");
+  CHECK(memory_[0] == std::byte(5));
+  CHECK(memory_[1] == std::byte(6));
+  CHECK(memory_[2] == std::byte(9));
+  CHECK(memory_[3] == std::byte(0));
+}
+
+TEST_CASE_METHOD(llvm_fixture_t, "llvm scan loop") {
+  exec("+>+>+>>+<<<<[>]+<[<]");
+  CHECK(memory_[3] == std::byte(1));
+  CHECK(memory_[4] == std::byte(1));
+}
+
+TEST_CASE_METHOD(llvm_fixture_t, "llvm executables share a session") {
+  // programs compiled by one machine coexist, are freed independently and
+  // outlive the machine
+  auto first = machine_->compile("+++");
+  {
+    auto dropped = machine_->compile("++");
+  }
+  auto second = machine_->compile("++++");
+  machine_.reset();
+
+  brainfk::llvm_machine_t other;
+  other.execute(first, memory_.get(), [](std::byte) {}, []() {
+    return std::byte(0);
+  });
+  CHECK(memory_[0] == std::byte(3));
+  std::fill_n(memory_.get(), 30'000, std::byte{});
+  other.execute(second, memory_.get(), [](std::byte) {}, []() {
+    return std::byte(0);
+  });
+  CHECK(memory_[0] == std::byte(4));
+}
+
+TEST_CASE("llvm machine runs its pipeline at every level", "[llvm]") {
+  auto options = GENERATE(brainfk::llvm_options_t{0},
+                          brainfk::llvm_options_t{1},
+                          brainfk::llvm_options_t{2},
+                          brainfk::llvm_options_t{3},
+                          brainfk::llvm_options_t{3, "function(sroa,gvn)"});
+  brainfk::llvm_machine_t machine{options};
+  auto memory = std::make_unique<std::byte[]>(30'000);
+  std::string output;
+  auto executable = machine.compile("++++++++[>++++++++<-]>+.>,[-<+>]<.");
+  machine.execute(
+      executable, memory.get(), [&](std::byte c) { output += char(c); },
+      []() { return std::byte(1); });
+  CHECK(output == "AB");
+}
+
+TEST_CASE("llvm machine rejects a bad pipeline", "[llvm]") {
+  CHECK_THROWS_AS(brainfk::llvm_machine_t{{4}}, std::runtime_error);
+  brainfk::llvm_machine_t machine{{3, "no-such-pass"}};
+  CHECK_THROWS_AS(machine.compile("+"), std::runtime_error);
+}
+
+TEST_CASE("llvm machine compiles a large program in parts", "[llvm]") {
+  // thousands of top level loops, printing the alphabet over and over
+  std::string program;
+  std::string expected;
+  for (int i = 0; i < 4'000; ++i) {
+    program += ">++++++++[<++++++++>-]<" +
+               std::string(std::size_t(i % 26 + 1), '+') + ".[-]";
+    expected += char('A' + i % 26);
+  }
+
+  const auto directory = make_temp_dir();
+  brainfk::guard directory_guard{
+      [&]() { std::filesystem::remove_all(directory); }};
+  const auto cache = std::make_shared<brainfk::code_cache_t>(directory);
+
+  // generated on two threads, then linked from the cache
+  for (int i = 0; i < 2; ++i) {
+    brainfk::llvm_machine_t machine{{1, "", 2}};
+    machine.cache(cache);
+    auto memory = std::make_unique<std::byte[]>(30'000);
+    std::string output;
+    auto executable = machine.compile(program);
+    machine.execute(
+        executable, memory.get(), [&](std::byte c) { output += char(c); },
+        []() { return std::byte(0); });
+    CHECK(output == expected);
+  }
+}
+
+TEMPLATE_TEST_CASE("scan finds the zero cell at a stride", "[scan]",
+                   std::uint8_t, std::uint16_t, std::uint32_t) {
+  auto stride = GENERATE(1, 2, 3, 4, 8, 9, 16, 32, 33);
+  auto direction = GENERATE(1, -1);
+  stride *= direction;
+
+  // wider cells have a zero low byte, which mustn't stop the scan either
+  std::vector<TestType> tape(1 << 14,
+                             TestType(sizeof(TestType) == 1 ? 1 : ~0xffu));
+  const auto start = tape.data() + tape.size() / 2;
+  auto distance = GENERATE(0, 1, 7, 31, 100);
+  auto zero = start + distance * stride;
+  *zero = 0;
+  // zeros off the stride mustn't stop the scan
+  if (stride != direction) {
+    start[direction] = 0;
+    start[distance * stride - direction] = 0;
+  }
+
+  CHECK(brainfk::scan(start, stride) == zero);
+}
+
+TEST_CASE("machines wrap cells at their width", "[cells]") {
+  const auto bits = GENERATE(8u, 16u, 32u);
+  const auto wide = bits != 8;
+
+  for (auto name : brainfk::machine_names()) {
+    auto machine = brainfk::make_machine(name, {}, bits);
+    CHECK(machine->cell_bits() == bits);
+    const auto run = [&](std::string_view program, std::string_view bytes,
+                         auto check) {
+      const brainfk::tape_t tape{16, 0, bits / 8};
+      std::string output;
+      brainfk::putc_output_t sink{[&](std::byte c) { output += char(c); }};
+      brainfk::memory_input_t source{std::as_bytes(std::span(bytes)),
+                                     brainfk::input_t::eof_t::minus_one};
+      const auto executable = machine->compile(program);
+      tape.run([&]() {
+        machine->execute(executable, tape.data(), sink, source);
+      });
+      brainfk::with_cell(bits, [&]<typename Cell>(std::type_identity<Cell>) {
+        check(output, reinterpret_cast<const Cell *>(tape.data()));
+      });
+    };
+
+    // 256 in the first cell, then 'A' if that isn't zero; -1 in the second
+    run("++++++++[>++++++++<-]>[<++++>-]<[>" + std::string(65, '+') +
+            ".[-]<[-]]>-",
+        "", [&]<typename Cell>(const std::string &output, const Cell *cells) {
+          CHECK(output == (wide ? "A" : ""));
+          CHECK(cells[1] == Cell(-1));
+        });
+    // a byte of 255 doesn't wrap to zero in a wider cell, end of input does
+    run(",+[>+.<[-]]>>,+", "\xff",
+        [&]<typename Cell>(const std::string &output, const Cell *cells) {
+          CHECK(output == (wide ? "\x01" : ""));
+          CHECK(cells[2] == 0);
+        });
+    // scans stop at whole zero cells, not zero bytes of one
+    run("+>+>+>+<<<[>]+<<<<[>>]+", "",
+        [&]<typename Cell>(const std::string &, const Cell *cells) {
+          CHECK(cells[4] == 1);
+          CHECK(cells[5] == 0);
+          CHECK(cells[6] == 1);
+        });
+    // output evaluated at compile time, packed a few bytes a write
+    run("+++++++[>++++++++++<-]>-----.+.+.+.+.", "",
+        [&]<typename Cell>(const std::string &output, const Cell *cells) {
+          CHECK(output == "ABCDE");
+          CHECK(cells[1] == 'E');
+        });
+  }
+}
+
+TEST_CASE("machines reject other cell widths", "[cells]") {
+  CHECK_THROWS_WITH(brainfk::make_machine("handrolled", {}, 12),
+                    "bad cell width: 12");
+}
+
+TEST_CASE("machines write output a buffer at a time", "[io]") {
+  for (auto name : brainfk::machine_names()) {
+    auto machine = brainfk::make_machine(name);
+    auto memory = std::make_unique<std::byte[]>(30'000);
+    recording_output_t output;
+    brainfk::memory_input_t input{{}, brainfk::input_t::eof_t::zero};
+    auto executable = machine->compile("++++++++[>++++++++<-]>+.+.+.+.+.+.");
+    machine->execute(executable, memory.get(), output, input);
+    CHECK(output.writes_ == std::vector<std::string>{"ABCD", "EF"});
+  }
+}
+
+TEST_CASE("machines stop at either end of the tape", "[tape]") {
+  const auto page = std::ptrdiff_t(::sysconf(_SC_PAGESIZE));
+  const auto [program, before, cell] = GENERATE_COPY(
+      std::tuple{std::string("<+"), std::size_t(0), std::ptrdiff_t(-1)},
+      std::tuple{std::string("+[>+]"), std::size_t(0), page},
+      std::tuple{std::string("+[<+]"), std::size_t(1), -page - 1},
+      // a move past the end lands in a guard sized to the program
+      std::tuple{std::string(std::size_t(page) * 2, '>') + "+",
+                 std::size_t(0), page * 2});
+
+  for (auto name : brainfk::machine_names()) {
+    auto machine = brainfk::make_machine(name);
+    const brainfk::tape_t tape{1, before, 1, brainfk::tape_t::reach(program)};
+    brainfk::string_output_t output;
+    brainfk::memory_input_t input{{}, brainfk::input_t::eof_t::zero};
+    auto executable = machine->compile(program);
+    CHECK_THROWS_WITH(tape.run([&]() {
+      machine->execute(executable, tape.data(), output, input);
+    }),
+                      std::format("tape overflow at cell {}", cell));
+  }
+}
+
+TEST_CASE("tapes can be indexed below zero", "[tape]") {
+  const brainfk::tape_t tape{1'000'000, 10};
+  brainfk::handrolled_machine_t machine;
+  brainfk::string_output_t output;
+  brainfk::memory_input_t input{{}, brainfk::input_t::eof_t::zero};
+  auto executable = machine.compile("<<<<<<<<<<+>>>>>>>>>>+[>+]");
+  CHECK_THROWS(tape.run([&]() {
+    machine.execute(executable, tape.data(), output, input);
+  }));
+  CHECK(tape.data()[-10] == std::byte(1));
+  CHECK(tape.data()[999'999] == std::byte(1));
+}
+
+TEST_CASE("a multiply loop that doesn't run stays on the tape", "[tape]") {
+  const auto page = std::size_t(::sysconf(_SC_PAGESIZE));
+  const auto program = "+" + std::string(page - 1, '>') + "[->>>>>+<<<<<]+";
+
+  for (auto name : brainfk::machine_names()) {
+    auto machine = brainfk::make_machine(name);
+    const brainfk::tape_t tape{1};
+    brainfk::string_output_t output;
+    brainfk::memory_input_t input{{}, brainfk::input_t::eof_t::zero};
+    auto executable = machine->compile(program);
+    CHECK_NOTHROW(tape.run([&]() {
+      machine->execute(executable, tape.data(), output, input);
+    }));
+    CHECK(tape.data()[page - 1] == std::byte(1));
+  }
+}
+
+TEST_CASE("a multiply loop that doesn't run skips targets past the tape",
+          "[tape]") {
+  const auto far = std::string(100'000, '>') + "+" +
+                   std::string(100'000, '<');
+  const auto program = ",[-" + far + "]" + std::string(49, '+') + ".";
+
+  for (auto name : brainfk::machine_names()) {
+    auto machine = brainfk::make_machine(name);
+    const brainfk::tape_t tape{brainfk::tape_t::default_size, 0, 1,
+                               brainfk::tape_t::reach(program)};
+    brainfk::string_output_t output;
+    const std::array zero{std::byte(0)};
+    brainfk::memory_input_t input{zero, brainfk::input_t::eof_t::zero};
+    auto executable = machine->compile(program);
+    CHECK_NOTHROW(tape.run([&]() {
+      machine->execute(executable, tape.data(), output, input);
+    }));
+    output.flush();
+    CHECK(output.str() == "1");
+  }
+}
+
+TEST_CASE("batches run each task on its own tape and output", "[batch]") {
+  // an echo, a program without input and two that fail
+  const std::vector<std::string> programs{
+      ",[.,]", "++++++++[>++++++++<-]>.", "[", "+[>+]"};
+
+  std::vector<brainfk::batch_task_t> tasks;
+  for (int i = 0; i < 64; ++i)
+    tasks.push_back({std::size_t(i % 2), std::format("task {}", i)});
+  tasks.push_back({2, ""});
+  tasks.push_back({3, ""});
+
+  for (auto name : brainfk::machine_names()) {
+    auto machine = brainfk::make_machine(name);
+    const auto results = brainfk::run_batch(
+        *machine, programs, tasks, {4, 100, 0, brainfk::input_t::eof_t::zero});
+
+    REQUIRE(results.size() == tasks.size());
+    for (int i = 0; i < 64; ++i) {
+      CHECK(results[std::size_t(i)].error.empty());
+      if (i % 2)
+        CHECK(results[std::size_t(i)].output == "@");
+      else
+        CHECK(results[std::size_t(i)].output == tasks[std::size_t(i)].input);
+    }
+    CHECK(results[64].error.starts_with("malformed program"));
+    CHECK(results[65].error.starts_with("tape overflow"));
+  }
+}
+
+TEST_CASE("machines profile nodes and loops", "[profile]") {
+  // add, open, add, put, add, close once the moves are folded
+  const std::string_view program = "+++\n[>+.<-] loop";
+  const std::vector<std::uint64_t> expected{1, 1, 3, 3, 3, 3};
+
+  for (auto name : brainfk::machine_names()) {
+    auto machine = brainfk::make_machine(name);
+    const brainfk::tape_t tape;
+    std::string output;
+    brainfk::putc_output_t sink{[&](std::byte c) { output += char(c); }};
+    brainfk::memory_input_t source{{}, brainfk::input_t::eof_t::zero};
+    CHECK(machine->profile(program, tape, sink, source) == expected);
+    CHECK(output == "\x01\x02\x03");
+  }
+
+  const auto listing = brainfk::profile_listing(program, expected);
+  CHECK(listing.contains("             1 | +++\n"));
+  CHECK(listing.contains("            13 | [>+.<-] loop\n"));
+  CHECK(listing.contains("           2:1                    1"
+                         "                    3\n"));
+  CHECK(brainfk::profile_stacks("t", program, expected) ==
+        "t 2\nt;loop@2:1 12\n");
+  CHECK_THROWS(brainfk::profile_listing("+", expected));
+}
+
+TEST_CASE("stats machine measures compiles and executes", "[stats]") {
+  brainfk::stats_machine_t machine{brainfk::make_machine("threaded")};
+  auto memory = std::make_unique<std::byte[]>(30'000);
+  std::string output;
+  brainfk::putc_output_t sink{[&](std::byte c) { output += char(c); }};
+  brainfk::memory_input_t source{{}, brainfk::input_t::eof_t::zero};
+  const auto executable = machine.compile(">[-]<++++++++[>++++++++<-]>+.");
+  machine.execute(executable, memory.get(), sink, source);
+  machine.execute(executable, memory.get(), sink, source);
+  CHECK(output == "AA");
+
+  const auto stats = machine.stats();
+  CHECK(stats.compiles == 1);
+  CHECK(stats.executes == 2);
+  CHECK(stats.execute.time > std::chrono::nanoseconds{});
+  // the counters are only there with a PMU and permission to use it, and
+  // the stats have them whenever this thread's can count
+  const brainfk::perf_counters_t counters;
+  CHECK(stats.execute.instructions.has_value() ==
+        counters.read().instructions.has_value());
+  if (stats.execute.instructions)
+    CHECK(*stats.execute.instructions > 0);
+
+  const auto table = brainfk::stats_table(stats);
+  CHECK(table.starts_with("phase "));
+  CHECK(table.contains("\ncompile       1 "));
+  CHECK(table.contains("\nexecute       2 "));
+}
+
+TEST_CASE("perf counts add up from empty totals", "[stats]") {
+  using namespace std::chrono_literals;
+
+  brainfk::perf_counts_t counted;
+  counted.time = 2ms;
+  counted.cycles = 10;
+  counted.instructions = 20;
+  brainfk::perf_counts_t total;
+  total += counted;
+  CHECK(total == counted);
+  total += counted;
+  CHECK(total.time == 4ms);
+  CHECK(total.cycles == 20);
+  CHECK(total.instructions == 40);
+  CHECK(!total.branch_misses);
+
+  // an event a span couldn't count is lost from the total for good
+  brainfk::perf_counts_t partial;
+  partial.time = 1ms;
+  partial.cycles = 5;
+  total += partial;
+  CHECK(total.cycles == 25);
+  CHECK(!total.instructions);
+  total += counted;
+  CHECK(total.cycles == 35);
+  CHECK(!total.instructions);
+}
+
+TEST_CASE("perf counts scale each span by its own running time",
+          "[stats]") {
+  using namespace std::chrono_literals;
+  using mark_t = brainfk::perf_counters_t::mark_t;
+
+  // cycles counted half the time up to the first mark, then all of it
+  mark_t from;
+  from.events[0] = {100, 100, 50};
+  from.time = std::chrono::steady_clock::time_point{1ms};
+  mark_t to;
+  to.events[0] = {110, 200, 150};
+  to.events[1] = {5, 5, 5};
+  to.time = std::chrono::steady_clock::time_point{3ms};
+
+  // scaled separately the totals would be 200 then about 147, and their
+  // difference would wrap
+  const auto counts = brainfk::perf_counters_t::between(from, to);
+  CHECK(counts.time == 2ms);
+  CHECK(counts.cycles == 10);
+  // not read at both marks
+  CHECK(!counts.instructions);
+
+  // a span multiplexed throughout is scaled up
+  to.events[0] = {110, 200, 100};
+  CHECK(brainfk::perf_counters_t::between(from, to).cycles == 20);
+}
+
+TEST_CASE("machines apply the eof policy", "[io]") {
+  using eof_t = brainfk::input_t::eof_t;
+  const auto [eof, expected] = GENERATE(std::pair{eof_t::zero, "ab\0"},
+                                        std::pair{eof_t::minus_one, "ab\xff"},
+                                        std::pair{eof_t::unchanged, "abX"});
+
+  for (auto name : brainfk::machine_names()) {
+    auto machine = brainfk::make_machine(name);
+    auto memory = std::make_unique<std::byte[]>(30'000);
+    std::string output;
+    brainfk::putc_output_t sink{[&](std::byte c) { output += char(c); }};
+    const std::string_view input = "ab";
+    brainfk::memory_input_t source{std::as_bytes(std::span(input)), eof};
+    auto executable =
+        machine->compile(",.,.[-]>++++++++[<+++++++++++>-]<,.");
+    machine->execute(executable, memory.get(), sink, source);
+    CHECK(output == std::string(expected, 3));
+  }
+}
+
+TEST_CASE("fd input reads from a file descriptor and flushes its tie",
+          "[io]") {
+  using namespace std::literals;
+  auto pipe = make_pipe();
+  brainfk::guard pipe_guard{[&]() {
+    close(pipe[0]);
+    close(pipe[1]);
+  }};
+
+  recording_output_t output;
+  brainfk::fd_input_t input{pipe[0], brainfk::input_t::eof_t::zero};
+  input.tie(&output);
+  output.put(std::byte('?'));
+
+  REQUIRE(::write(pipe[1], "xy", 2) == 2);
+  close(pipe[1]);
+  pipe[1] = -1;
+
+  CHECK(input.get(std::byte(1)) == std::byte('x'));
+  CHECK(output.writes_ == std::vector<std::string>{"?"});
+  CHECK(input.get(std::byte(1)) == std::byte('y'));
+  CHECK(input.get(std::byte(1)) == std::byte(0));
+}
+
+TEST_CASE("fd output writes to a file descriptor", "[io]") {
+  using namespace std::literals;
+  auto pipe = make_pipe();
+  brainfk::guard pipe_guard{[&]() {
+    close(pipe[0]);
+    close(pipe[1]);
+  }};
+
+  {
+    brainfk::fd_output_t output{pipe[1]};
+    output.put(std::byte('H'));
+    output.put(std::byte('i'));
+    CHECK(drain(pipe[0]).empty());
+  }
+
+  CHECK(drain(pipe[0]) == "Hi"sv);
+}
+
+TEST_CASE("code cache keys ignore comments and layout", "[cache]") {
+  using brainfk::code_cache_t;
+  CHECK(code_cache_t::key("+[-]>.", {"a"}) ==
+        code_cache_t::key("add +\n[ - ] then > and .", {"a"}));
+  CHECK(code_cache_t::key("+[-]>.", {"a"}) !=
+        code_cache_t::key("+[-]>.", {"b"}));
+  CHECK(code_cache_t::key("+", {"ab", "c"}) !=
+        code_cache_t::key("+", {"a", "bc"}));
+}
+
+TEST_CASE("code cache lives in the user's cache directory", "[cache]") {
+  using brainfk::code_cache_t;
+  // put back whatever the environment had
+  std::vector<std::pair<std::string, std::optional<std::string>>> saved;
+  for (const auto name : {"XDG_CACHE_HOME", "HOME"}) {
+    const auto value = std::getenv(name);
+    saved.emplace_back(name, value ? std::optional<std::string>{value}
+                                   : std::nullopt);
+  }
+  brainfk::guard environment_guard{[&]() {
+    for (const auto &[name, value] : saved) {
+      if (value)
+        ::setenv(name.c_str(), value->c_str(), 1);
+      else
+        ::unsetenv(name.c_str());
+    }
+  }};
+
+  ::setenv("XDG_CACHE_HOME", "/xdg", 1);
+  ::setenv("HOME", "/home", 1);
+  CHECK(code_cache_t::default_directory() == "/xdg/ccbf");
+  ::unsetenv("XDG_CACHE_HOME");
+  CHECK(code_cache_t::default_directory() == "/home/.cache/ccbf");
+  // not somewhere shared like /tmp
+  ::unsetenv("HOME");
+  CHECK(!code_cache_t::default_directory());
+}
+
+TEST_CASE("llvm cache entries differ by code generation level",
+          "[cache]") {
+  const auto directory = make_temp_dir();
+  brainfk::guard directory_guard{
+      [&]() { std::filesystem::remove_all(directory); }};
+  const auto cache = std::make_shared<brainfk::code_cache_t>(directory);
+
+  // the same passes, so only the level tells them apart
+  for (const auto level : {0u, 3u}) {
+    brainfk::llvm_machine_t machine{{level, "function(instcombine)"}};
+    machine.cache(cache);
+    machine.compile(",[.,]");
+  }
+
+  std::size_t entries = 0;
+  for (const auto &entry :
+       std::filesystem::recursive_directory_iterator(directory))
+    entries += entry.is_regular_file();
+  CHECK(entries == 2);
+}
+
+TEST_CASE("code cache stores and loads entries", "[cache]") {
+  const auto directory = make_temp_dir();
+  brainfk::guard directory_guard{
+      [&]() { std::filesystem::remove_all(directory); }};
+
+  brainfk::code_cache_t cache{directory / "nested"};
+  const auto key = brainfk::code_cache_t::key("+", {});
+  CHECK(!cache.load(key));
+
+  const std::vector<std::byte> code{std::byte(1), std::byte(2)};
+  cache.store(key, code);
+  CHECK(cache.load(key) == code);
+}
+
+TEST_CASE("machines run code from the cache", "[cache]") {
+  const auto directory = make_temp_dir();
+  brainfk::guard directory_guard{
+      [&]() { std::filesystem::remove_all(directory); }};
+  const auto cache = std::make_shared<brainfk::code_cache_t>(directory);
+
+  const auto run = [&](std::string_view name) {
+    auto machine = brainfk::make_machine(name);
+    machine->cache(cache);
+    auto memory = std::make_unique<std::byte[]>(30'000);
+    std::string output;
+    auto executable = machine->compile("++++++++[>++++++++<-]>+.+.");
+    // the same program again shares the first's code
+    auto again = machine->compile("++++++++[>++++++++<-]>+.+.");
+    machine->execute(
+        executable, memory.get(), [&](std::byte c) { output += char(c); },
+        []() { return std::byte(0); });
+    return output;
+  };
+
+  const auto entries = [&]() {
+    std::vector<std::filesystem::path> result;
+    for (const auto &entry :
+         std::filesystem::recursive_directory_iterator(directory))
+      if (entry.is_regular_file())
+        result.push_back(entry.path());
+    return result;
+  };
+
+  for (auto name : brainfk::machine_names()) {
+    CHECK(run(name) == "AB");
+    CHECK(run(name) == "AB");
+  }
+  // handrolled and threaded share bytecode
+  REQUIRE(entries().size() == 2);
+
+  // corrupt entries are regenerated
+  for (const auto &entry : entries())
+    std::ofstream{entry} << "garbage";
+  for (auto name : brainfk::machine_names())
+    CHECK(run(name) == "AB");
+}
+
+TEST_CASE("machines resume each other's checkpoints", "[checkpoint]") {
+  const auto directory = make_temp_dir();
+  brainfk::guard directory_guard{
+      [&]() { std::filesystem::remove_all(directory); }};
+  const auto bits = GENERATE(8u, 16u);
+  const auto steps = GENERATE(0u, 3u, 8u);
+
+  // add 8 to each byte of input; the inner loop becomes a multiply so each
+  // byte after the first takes a back edge
+  const std::string_view program = ",[>++++++++[<+>-]<.,]";
+  const std::string_view bytes = "abcdefghij";
+  const auto path = directory / "checkpoint";
+
+  for (auto from : {"handrolled", "threaded", "tiered"}) {
+    for (auto to : brainfk::machine_names()) {
+      std::string output;
+      brainfk::putc_output_t sink{[&](std::byte c) { output += char(c); }};
+      std::optional<brainfk::position_t> position;
+
+      {
+        auto machine = brainfk::make_machine(from, {}, bits);
+        const brainfk::tape_t tape{16, 0, bits / 8};
+        brainfk::memory_input_t source{std::as_bytes(std::span(bytes)),
+                                       brainfk::input_t::eof_t::zero};
+        brainfk::suspend_t suspend{steps};
+        const auto executable = machine->compile(program);
+        tape.run([&]() {
+          position = machine->execute(executable, tape.data(), sink, source,
+                                      suspend);
+        });
+        REQUIRE(position);
+
+        brainfk::checkpoint_t checkpoint;
+        checkpoint.program_key = brainfk::checkpoint_t::key(program);
+        checkpoint.cell_bits = bits;
+        checkpoint.position = *position;
+        checkpoint.input = source.consumed();
+        checkpoint.capture(tape);
+        checkpoint.save(path);
+      }
+
+      auto machine = brainfk::make_machine(to, {}, bits);
+      const brainfk::tape_t tape{16, 0, bits / 8};
+      brainfk::memory_input_t source{std::as_bytes(std::span(bytes)),
+                                     brainfk::input_t::eof_t::zero};
+      brainfk::suspend_t suspend;
+      const auto checkpoint = brainfk::checkpoint_t::load(path);
+      CHECK(checkpoint.position == *position);
+      checkpoint.restore(tape, brainfk::checkpoint_t::instructions(program));
+      source.skip(checkpoint.input);
+      const auto executable = machine->compile(program);
+      const auto resume = [&]() {
+        tape.run([&]() {
+          position = machine->execute(executable, tape.data(), sink, source,
+                                      suspend, checkpoint.position);
+        });
+      };
+
+      if (to == "llvm") {
+        CHECK_THROWS_WITH(
+            resume(), "this machine can't start part way through a program");
+        continue;
+      }
+      resume();
+      CHECK(!position);
+      CHECK(output == "ijklmnopqr");
+    }
+  }
+}
+
+TEST_CASE("machines say whether they can suspend a run", "[checkpoint]") {
+  // loops nested deep enough for the auto machine to run them on llvm
+  std::string deep;
+  for (int i = 0; i < 8; ++i)
+    deep += ",[";
+  deep += "-" + std::string(8, ']');
+  REQUIRE(brainfk::auto_machine_t::choose(brainfk::ir::compile(deep)) ==
+          "llvm");
+
+  for (auto name : brainfk::machine_names()) {
+    auto machine = brainfk::make_machine(name);
+    CHECK(machine->can_suspend(machine->compile("+[-]")) == (name != "llvm"));
+    const auto suspends = name != "llvm" && name != "auto";
+    CHECK(machine->can_suspend(machine->compile(deep)) == suspends);
+    brainfk::stats_machine_t stats{brainfk::make_machine(name)};
+    CHECK(stats.can_suspend(stats.compile(deep)) == suspends);
+  }
+}
+
+TEST_CASE("checkpoints keep sparse tapes small", "[checkpoint]") {
+  const auto directory = make_temp_dir();
+  brainfk::guard directory_guard{
+      [&]() { std::filesystem::remove_all(directory); }};
+  const auto path = directory / "checkpoint";
+
+  const brainfk::tape_t tape{1 << 20, 3};
+  tape.data()[-3] = std::byte(1);
+  tape.data()[900'000] = std::byte(2);
+
+  brainfk::checkpoint_t checkpoint;
+  checkpoint.program_key = brainfk::checkpoint_t::key("+[>+]");
+  checkpoint.position = {4, 900'000};
+  checkpoint.input = 7;
+  checkpoint.capture(tape);
+  CHECK(checkpoint.first == -3);
+  CHECK(checkpoint.cells.size() == 900'004);
+  checkpoint.save(path);
+  CHECK(std::filesystem::file_size(path) < 100);
+
+  const auto loaded = brainfk::checkpoint_t::load(path);
+  CHECK(loaded.program_key == checkpoint.program_key);
+  CHECK(loaded.position == checkpoint.position);
+  CHECK(loaded.input == 7);
+  CHECK(loaded.first == -3);
+  CHECK(loaded.cells == checkpoint.cells);
+
+  const brainfk::tape_t other{1 << 20, 3};
+  const auto instructions = brainfk::checkpoint_t::instructions("+[>+]");
+  loaded.restore(other, instructions);
+  CHECK(std::ranges::equal(tape.cells(), other.cells()));
+  CHECK_THROWS_WITH(loaded.restore(brainfk::tape_t{16}, instructions),
+                    "the checkpoint's cells from -3 don't fit the tape");
+
+  // as are positions off the tape or past the program
+  auto moved = loaded;
+  moved.position.cell = std::ptrdiff_t(1) << 41;
+  CHECK_THROWS_WITH(
+      moved.restore(other, instructions),
+      std::format("the checkpoint's cell {} is off the tape", 1ull << 41));
+  moved.position = {instructions + 1, 0};
+  CHECK_THROWS_WITH(moved.restore(other, instructions),
+                    std::format("the checkpoint's instruction {} is past "
+                                "the program's {}",
+                                instructions + 1, instructions));
+
+  // a checkpoint cut short is rejected rather than half restored
+  std::filesystem::resize_file(path, std::filesystem::file_size(path) - 1);
+  CHECK_THROWS_WITH(brainfk::checkpoint_t::load(path),
+                    std::format("{} is a corrupt checkpoint", path.string()));
+  std::ofstream{path} << "garbage";
+  CHECK_THROWS_WITH(brainfk::checkpoint_t::load(path),
+                    std::format("{} isn't a checkpoint", path.string()));
+}